@@ -0,0 +1,288 @@
+#include "exprcpp/compiler.h"
+#include "exprcpp/dump_info.h"
+#include "exprcpp/jit_src_builder.h"
+#include "exprcpp/support.h"
+
+#include <gsl/gsl>
+#include <vapoursynth/VapourSynth.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std::literals;
+
+namespace exprcpp {
+
+constexpr auto usage{
+R"EOS(Usage: exprcpp_aot [options] -o <output>
+
+Compiles expr_cpp() kernels ahead of time. Output is a shared library, which
+can be passed to expr_cpp() as kernel_path, or a relocatable object file, if
+output has .o or .obj extension.
+
+Options mirror expr_cpp() arguments:
+  --clip <format>         Format of the next input clip, e.g. YUV420P8, GrayS.
+                          Can be repeated.
+  --clip-subsampling <w>,<h>
+                          Log2 of how many times the last clip is smaller than
+                          output, e.g. 1,1 for chroma of YUV420. Only for
+                          single-plane clips.
+  --format <format>       Format of the next output. Can be repeated, missing
+                          ones are the same as the last one. Defaults to the
+                          first clip's format.
+  --outputs <count>       Number of outputs.
+  --code <code>           User code or function name for the next plane. Can
+                          be repeated, same rules as for expr_cpp() apply.
+  --source-path <path>    Path to file with user code.
+  --resample <mode>       nearest or average.
+  --padded                Process rows up to stride padding.
+  --scan <direction>      right, left, down or up.
+  --param <name>          Name of the next user parameter. Can be repeated.
+  --prop <name>           Frame property to specialize kernels on.
+  --prop-value <value>    Value to specialize kernels for. Can be repeated.
+  --cxxflag <flag>        Compiler flag. Can be repeated. Replaces defaults.
+  --remarks               Print loop vectorization remarks.
+  --dump-path <path>
+  --dump-source
+  --dump-bitcode
+)EOS"};
+
+// Parses names of VapourSynth format presets, e.g. Gray16, YUV420PS, RGB24
+VSFormat parse_format(const std::string& name)
+{
+    std::string upper{name};
+    std::transform(upper.begin(), upper.end(), upper.begin(),
+                   [](unsigned char c) { return std::toupper(c); });
+
+    VSFormat fmt{};
+    std::strncpy(fmt.name, name.c_str(), sizeof(fmt.name) - 1);
+    auto set_sample_type{[&](const std::string& type) {
+        if (type == "H"s || type == "S"s) {
+            fmt.sampleType = stFloat;
+            fmt.bitsPerSample = type == "H"s ? 16 : 32;
+        } else {
+            fmt.sampleType = stInteger;
+            fmt.bitsPerSample = std::stoi(type);
+        }
+        fmt.bytesPerSample = fmt.bitsPerSample <= 8 ? 1
+                             : fmt.bitsPerSample <= 16 ? 2 : 4;
+    }};
+
+    try {
+        if (upper.rfind("GRAY"s, 0) == 0) {
+            fmt.colorFamily = cmGray;
+            fmt.numPlanes = 1;
+            set_sample_type(upper.substr(4));
+        } else if (upper.rfind("YUV"s, 0) == 0 && upper.size() > 7
+                   && upper[6] == 'P') {
+            static const std::map<std::string, std::pair<int, int>>
+                subsamplings{{"444"s, {0, 0}}, {"440"s, {0, 1}},
+                             {"422"s, {1, 0}}, {"420"s, {1, 1}},
+                             {"411"s, {2, 0}}, {"410"s, {2, 2}}};
+            const auto [sub_w, sub_h]{subsamplings.at(upper.substr(3, 3))};
+            fmt.colorFamily = cmYUV;
+            fmt.numPlanes = 3;
+            fmt.subSamplingW = sub_w;
+            fmt.subSamplingH = sub_h;
+            set_sample_type(upper.substr(7));
+        } else if (upper.rfind("RGB"s, 0) == 0) {
+            fmt.colorFamily = cmRGB;
+            fmt.numPlanes = 3;
+            const std::string type{upper.substr(3)};
+            set_sample_type(type == "H"s || type == "S"s
+                            ? type : std::to_string(std::stoi(type) / 3));
+        } else {
+            throw std::invalid_argument{name};
+        }
+    } catch (const std::logic_error&) {
+        throw std::runtime_error{"Unknown format: "s + name};
+    }
+    return fmt;
+}
+
+int run(int argc, char** argv)
+{
+    // Jit_src_builder refers to formats, so they need stable addresses
+    std::list<VSFormat> src_fmts_storage;
+    std::vector<const VSFormat*> src_fmts;
+    std::vector<std::pair<int, int>> single_plane_subs;
+    std::list<VSFormat> dst_fmts;
+    gsl::index outputs{1};
+    std::vector<std::string> codes;
+    std::filesystem::path source_path;
+    std::filesystem::path output_path;
+    auto resample{Jit_src_builder::Resample::nearest};
+    bool padded{false};
+    auto scan{Jit_src_builder::Scan::none};
+    std::vector<std::string> param_names;
+    std::string prop_name;
+    std::vector<std::int64_t> prop_values;
+    std::vector<std::string> user_cxxflags;
+    bool user_cxxflags_present{false};
+    bool remarks{false};
+    Dump_info dump_info;
+
+    for (int i{1}; i < argc; ++i) {
+        const std::string arg{argv[i]};
+        auto value{[&]() -> std::string {
+            if (i + 1 == argc) {
+                throw std::runtime_error{"Missing value for "s + arg};
+            }
+            return argv[++i];
+        }};
+
+        if (arg == "-h"s || arg == "--help"s) {
+            std::cout << usage;
+            return 0;
+        } else if (arg == "-o"s) {
+            output_path = value();
+        } else if (arg == "--clip"s) {
+            src_fmts.push_back(
+                &src_fmts_storage.emplace_back(parse_format(value())));
+            single_plane_subs.emplace_back(0, 0);
+        } else if (arg == "--clip-subsampling"s) {
+            const std::string subs{value()};
+            const auto comma{subs.find(',')};
+            if (src_fmts.empty() || src_fmts.back()->numPlanes != 1
+                || comma == std::string::npos) {
+                throw std::runtime_error{
+                    "--clip-subsampling requires a single-plane --clip "s
+                    "before it and a value like 1,1"s};
+            }
+            const int sub_w{std::stoi(subs.substr(0, comma))};
+            const int sub_h{std::stoi(subs.substr(comma + 1))};
+            if (sub_w < 0 || sub_w > 4 || sub_h < 0 || sub_h > 4) {
+                throw std::runtime_error{"Subsampling must be from 0 to 4"s};
+            }
+            single_plane_subs.back() = {sub_w, sub_h};
+        } else if (arg == "--format"s) {
+            dst_fmts.push_back(parse_format(value()));
+        } else if (arg == "--outputs"s) {
+            outputs = std::stoi(value());
+        } else if (arg == "--code"s) {
+            codes.push_back(value());
+        } else if (arg == "--source-path"s) {
+            source_path = value();
+        } else if (arg == "--resample"s) {
+            const std::string mode{value()};
+            if (mode == "nearest"s) {
+                resample = Jit_src_builder::Resample::nearest;
+            } else if (mode == "average"s) {
+                resample = Jit_src_builder::Resample::average;
+            } else {
+                throw std::runtime_error{"Unknown resample mode: "s + mode};
+            }
+        } else if (arg == "--padded"s) {
+            padded = true;
+        } else if (arg == "--scan"s) {
+            scan = Jit_src_builder::parse_scan(value());
+        } else if (arg == "--param"s) {
+            param_names.push_back(value());
+        } else if (arg == "--prop"s) {
+            prop_name = value();
+        } else if (arg == "--prop-value"s) {
+            prop_values.push_back(std::stoll(value()));
+        } else if (arg == "--cxxflag"s) {
+            user_cxxflags.push_back(value());
+            user_cxxflags_present = true;
+        } else if (arg == "--remarks"s) {
+            remarks = true;
+        } else if (arg == "--dump-path"s) {
+            dump_info.dump_path = value();
+        } else if (arg == "--dump-source"s) {
+            dump_info.dump_source(true);
+        } else if (arg == "--dump-bitcode"s) {
+            dump_info.dump_bitcode(true);
+        } else {
+            throw std::runtime_error{"Unknown argument: "s + arg};
+        }
+    }
+
+    if (src_fmts.empty()) { throw std::runtime_error{"No input clips"s}; }
+    if (codes.empty()) { throw std::runtime_error{"No code"s}; }
+    if (output_path.empty()) { throw std::runtime_error{"No output path"s}; }
+    if (outputs < 1) { throw std::runtime_error{"No outputs"s}; }
+    if (dst_fmts.empty()) { dst_fmts.push_back(*src_fmts[0]); }
+    while (ssize(dst_fmts) < outputs) { dst_fmts.push_back(dst_fmts.back()); }
+    while (ssize(dst_fmts) > outputs) { dst_fmts.pop_back(); }
+    const VSFormat* dst_fmt{&dst_fmts.front()};
+    Jit_src_builder src_builder_common{src_fmts};
+    src_builder_common.dst_fmt = dst_fmt;
+    src_builder_common.single_plane_subs = single_plane_subs;
+    for (auto it{std::next(dst_fmts.cbegin())}; it != dst_fmts.cend(); ++it) {
+        src_builder_common.extra_dst_fmts.push_back(&*it);
+    }
+    src_builder_common.resample = resample;
+    src_builder_common.padded = padded;
+    src_builder_common.scan = scan;
+    src_builder_common.param_names = param_names;
+    src_builder_common.prop_name = prop_name;
+    src_builder_common.check_user_names(prop_values);
+    if (!source_path.empty()) {
+        src_builder_common.user_code(source_path);
+    }
+
+    std::vector<Jit_src_builder> src_builders;
+    for (gsl::index i{0}; i != dst_fmt->numPlanes; ++i) {
+        // As with expr_cpp(), missing code means the last one
+        const std::string& code{codes[std::min(i, ssize(codes) - 1)]};
+        if (code.empty()) { continue; }
+        // Generic kernel comes first, then specialized ones
+        std::vector<std::optional<std::int64_t>> variants{std::nullopt};
+        variants.insert(variants.cend(), prop_values.cbegin(),
+                        prop_values.cend());
+        for (const auto& prop_value: variants) {
+            Jit_src_builder& src_builder{
+                src_builders.emplace_back(src_builder_common)};
+            src_builder.plane = gsl::narrow_cast<int>(i);
+            src_builder.prop_value = prop_value;
+            if (!source_path.empty()) {
+                src_builder.user_func_name = code;
+            } else {
+                src_builder.user_code(code);
+            }
+        }
+    }
+    if (src_builders.empty()) {
+        throw std::runtime_error{"Every plane is copied, nothing to compile"s};
+    }
+
+    std::vector<const char*> cxxflags;
+    if (user_cxxflags_present) {
+        for (const auto& cxxflag: user_cxxflags) {
+            cxxflags.push_back(cxxflag.c_str());
+        }
+    } else {
+        cxxflags = default_cxxflags;
+    }
+    if (remarks) {
+        cxxflags.insert(cxxflags.cend(), remark_cxxflags.cbegin(),
+                        remark_cxxflags.cend());
+    }
+
+    exprcpp_get_compiler()->compile_to_file(src_builders, dump_info, cxxflags,
+                                            output_path);
+    return 0;
+}
+} // namespace exprcpp
+
+int main(int argc, char** argv) try
+{
+    return exprcpp::run(argc, argv);
+} catch (const std::exception& ex) {
+    std::cerr << "exprcpp_aot: " << ex.what() << '\n'
+              << "Try --help for usage\n";
+    return 1;
+}
\ No newline at end of file
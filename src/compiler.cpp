@@ -0,0 +1,653 @@
+#include "exprcpp/compiler.h"
+
+#include "exprcpp/ast_action.h"
+#include "exprcpp/jit_src_builder.h"
+#include "exprcpp/llvm_support.h"
+#include "exprcpp/support.h"
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#include <clang/Basic/Diagnostic.h>
+#include <clang/Basic/DiagnosticFrontend.h>
+#include <clang/Basic/DiagnosticIDs.h>
+#include <clang/Basic/DiagnosticOptions.h>
+#include <clang/Basic/SourceLocation.h>
+#include <clang/Basic/SourceManager.h>
+#include <clang/CodeGen/CodeGenAction.h>
+#include <clang/Driver/Compilation.h>
+#include <clang/Driver/Driver.h>
+#include <clang/Driver/Job.h>
+#include <clang/Driver/Tool.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/CompilerInvocation.h>
+#include <clang/Frontend/FrontendAction.h>
+#include <clang/Frontend/TextDiagnosticPrinter.h>
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/ExecutionEngine/JITSymbol.h>
+#include <llvm/ExecutionEngine/Orc/DebugUtils.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/ExecutionEngine/RuntimeDyld.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Option/Option.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/Memory.h>
+#include <llvm/Support/raw_os_ostream.h>
+#include <llvm/Support/raw_ostream.h>
+#if LLVM_VERSION_MAJOR >= 14
+#include <llvm/MC/TargetRegistry.h>
+#else
+#include <llvm/Support/TargetRegistry.h>
+#endif
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/VirtualFileSystem.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+#pragma clang diagnostic pop
+
+#include <gsl/gsl>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+using namespace std::literals;
+
+namespace exprcpp {
+
+struct Module_info {
+    // Null if module was created in external context
+    std::unique_ptr<llvm::LLVMContext> ctx;
+    std::unique_ptr<llvm::Module> module;
+    std::string entry_name_mangled;
+    std::vector<Remark> remarks;
+};
+
+// Collects optimization remarks and passes other diagnostics to the printer
+class Remark_collector : public clang::DiagnosticConsumer {
+    std::unique_ptr<clang::DiagnosticConsumer> printer_;
+    std::vector<Remark>& remarks_;
+
+public:
+    Remark_collector(std::unique_ptr<clang::DiagnosticConsumer> printer,
+                     std::vector<Remark>& remarks)
+        : printer_{std::move(printer)}, remarks_{remarks}
+    {}
+
+    void BeginSourceFile(const clang::LangOptions& lang_opts,
+                         const clang::Preprocessor* pp) override
+    {
+        printer_->BeginSourceFile(lang_opts, pp);
+    }
+
+    void EndSourceFile() override { printer_->EndSourceFile(); }
+
+    void finish() override { printer_->finish(); }
+
+    void HandleDiagnostic(clang::DiagnosticsEngine::Level level,
+                          const clang::Diagnostic& info) override
+    {
+        // Counts errors, which frontend actions report failure by
+        DiagnosticConsumer::HandleDiagnostic(level, info);
+        if (level != clang::DiagnosticsEngine::Remark) {
+            printer_->HandleDiagnostic(level, info);
+            return;
+        }
+
+        llvm::SmallString<256> text;
+        if (info.getLocation().isValid() && info.hasSourceManager()) {
+            const clang::PresumedLoc loc{
+                info.getSourceManager().getPresumedLoc(info.getLocation())};
+            if (loc.isValid()) {
+                llvm::raw_svector_ostream os{text};
+                os << loc.getFilename() << ':' << loc.getLine() << ':'
+                   << loc.getColumn() << ": ";
+            }
+        }
+        info.FormatDiagnostic(text);
+
+        const bool missed{
+            info.getID()
+            == clang::diag::remark_fe_backend_optimization_remark_missed};
+        remarks_.push_back({missed, std::string{text.str()}});
+    }
+};
+
+Module_info process_source(Jit_src_builder& src_builder,
+                           const Dump_info& dump_info,
+                           const std::vector<const char*>& cxxflags,
+                           llvm::LLVMContext* external_ctx = nullptr)
+{
+    llvm::IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> mem_vfs{
+        new llvm::vfs::InMemoryFileSystem{}};
+    llvm::IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> vfs{
+        new llvm::vfs::OverlayFileSystem{mem_vfs}};
+    vfs->pushOverlay(llvm::vfs::getRealFileSystem());
+
+    llvm::raw_os_ostream llvm_cout{std::cout};
+
+    llvm::IntrusiveRefCntPtr<clang::DiagnosticOptions> diag_opts{
+        new clang::DiagnosticOptions()};
+    clang::TextDiagnosticPrinter* diag_client{
+        new clang::TextDiagnosticPrinter{llvm_cout, diag_opts.get()}};
+    llvm::IntrusiveRefCntPtr<clang::DiagnosticIDs> diag_id{
+        new clang::DiagnosticIDs()};
+    clang::DiagnosticsEngine diags{diag_id, diag_opts.get(), diag_client};
+
+    auto build_compiler_invocation{[&](const std::string& file_name) {
+        clang::driver::Driver driver{"clang++", llvm::sys::getProcessTriple(),
+                                     diags, vfs};
+
+        llvm::SmallVector<const char*, 20> args{
+            "clang++", file_name.c_str(), "-fsyntax-only"};
+        args.append(cxxflags.cbegin(), cxxflags.cend());
+        std::unique_ptr<clang::driver::Compilation> compilation{
+            driver.BuildCompilation(args)};
+        if (!compilation) {
+            throw std::runtime_error{"Failed to create compilation"s};
+        }
+
+        const clang::driver::JobList& jobs{compilation->getJobs()};
+        if (ssize(jobs) != 1
+            || !clang::isa<clang::driver::Command>(*jobs.begin()))
+        {
+            throw std::runtime_error{"Failed to create job list"s};
+        }
+        const clang::driver::Command& cmd{
+            llvm::cast<clang::driver::Command>(*jobs.begin())};
+        const llvm::opt::ArgStringList& cc_args{cmd.getArguments()};
+        auto ci{std::make_unique<clang::CompilerInvocation>()};
+        clang::CompilerInvocation::CreateFromArgs(*ci, cc_args, diags);
+        // Driver asks frontend to leak its state for faster exit, which
+        // doesn't suit a long-living process
+        ci->getFrontendOpts().DisableFree = false;
+        return ci;
+    }};
+
+    clang::CompilerInstance ci{};
+    ci.createFileManager(vfs);
+    if (!ci.hasFileManager()) {
+        throw std::runtime_error{
+            "Failed to create file manager from virtual FS"s};
+    }
+
+    Module_info info;
+    auto execute_action{[&](clang::FrontendAction& action) {
+        ci.createDiagnostics(new Remark_collector{
+            std::make_unique<clang::TextDiagnosticPrinter>(
+                llvm::errs(), &ci.getDiagnosticOpts()),
+            info.remarks});
+        if (!ci.hasDiagnostics()) {
+            throw std::runtime_error{"Failed to create diagnostics engine"s};
+        }
+        ci.resetAndLeakSourceManager();
+        if (!ci.ExecuteAction(action)) {
+            throw std::runtime_error{"Failed to execute frontend action"s};
+        }
+    }};
+
+    if (src_builder.user_func_name.empty()) {
+        mem_vfs->addFile(
+            "expr.cpp", std::time(nullptr),
+            llvm::MemoryBuffer::getMemBufferCopy(src_builder.user_code()));
+        ci.setInvocation(build_compiler_invocation("expr.cpp"s));
+
+        std::string user_func_name{};
+        {
+            std::string _;
+            Name_extractor_action name_action{user_func_name, _};
+            execute_action(name_action);
+        }
+        if (user_func_name.empty()) {
+            throw std::runtime_error{"User function not found"s};
+        }
+        src_builder.user_func_name = user_func_name;
+    }
+
+    std::string jit_source{src_builder.full_source()};
+
+    if (dump_info.dump_source()) {
+        std::ofstream ofs{dump_info.dump_path
+                          / (src_builder.user_func_name + "_dump.cpp"s)};
+        ofs << jit_source;
+    }
+
+    mem_vfs->addFile("expr_full.cpp", std::time(nullptr),
+                     llvm::MemoryBuffer::getMemBuffer(jit_source));
+
+    ci.setInvocation(build_compiler_invocation("expr_full.cpp"s));
+
+    {
+        std::string _;
+        Name_extractor_action name_action{_, info.entry_name_mangled};
+        execute_action(name_action);
+    }
+
+    clang::EmitLLVMOnlyAction main_action{external_ctx};
+    execute_action(main_action);
+
+    if (!external_ctx) {
+        info.ctx.reset(main_action.takeLLVMContext());
+    }
+    info.module = main_action.takeModule();
+    if (!info.module) { throw std::runtime_error{"Failed to create module"s}; }
+
+    if (dump_info.dump_bitcode()) {
+        std::ofstream ofs{dump_info.dump_path
+                          / (src_builder.user_func_name + "_dump.bc"s),
+                          std::ofstream::binary};
+        llvm::raw_os_ostream os{ofs};
+        WriteBitcodeToFile(*info.module, os);
+    }
+
+    if (dump_info.any() && !info.remarks.empty()) {
+        std::ofstream ofs{dump_info.dump_path
+                          / (src_builder.user_func_name + "_remarks.txt"s)};
+        for (const auto& remark: info.remarks) { ofs << remark.text << '\n'; }
+    }
+
+    return info;
+}
+
+// Counts memory mapped for code and data of a kernel, and of all kernels
+// together
+class Counting_mapper : public llvm::SectionMemoryManager::MemoryMapper {
+    std::atomic<std::size_t>& total_size_;
+    std::atomic<std::size_t> mapped_size_{0};
+
+public:
+    explicit Counting_mapper(std::atomic<std::size_t>& total_size)
+        : total_size_{total_size}
+    {}
+
+    std::size_t mapped_size() const { return mapped_size_; }
+
+    llvm::sys::MemoryBlock allocateMappedMemory(
+        llvm::SectionMemoryManager::AllocationPurpose, size_t num_bytes,
+        const llvm::sys::MemoryBlock* near_block, unsigned flags,
+        std::error_code& ec) override
+    {
+        auto block{llvm::sys::Memory::allocateMappedMemory(
+            num_bytes, near_block, flags, ec)};
+        mapped_size_ += block.allocatedSize();
+        total_size_ += block.allocatedSize();
+        return block;
+    }
+
+    std::error_code protectMappedMemory(const llvm::sys::MemoryBlock& block,
+                                        unsigned flags) override
+    {
+        return llvm::sys::Memory::protectMappedMemory(block, flags);
+    }
+
+    std::error_code releaseMappedMemory(llvm::sys::MemoryBlock& block) override
+    {
+        mapped_size_ -= block.allocatedSize();
+        total_size_ -= block.allocatedSize();
+        return llvm::sys::Memory::releaseMappedMemory(block);
+    }
+};
+
+// Code and data pages of a single kernel, released along with it
+class Kernel_memory : public llvm::SectionMemoryManager {
+public:
+    explicit Kernel_memory(Counting_mapper& mapper)
+        : llvm::SectionMemoryManager{&mapper}
+    {}
+
+    ~Kernel_memory() override { deregisterEHFrames(); }
+};
+
+// Allocates sections of a single kernel from its memory. It's owned by the
+// JIT, which is destroyed right after compilation, so it can't own memory
+// itself.
+class Kernel_memory_manager : public llvm::RuntimeDyld::MemoryManager {
+    Kernel_memory& memory_;
+    std::size_t& code_size_;
+
+public:
+    Kernel_memory_manager(Kernel_memory& memory, std::size_t& code_size)
+        : memory_{memory}, code_size_{code_size}
+    {}
+
+    uint8_t* allocateCodeSection(uintptr_t size, unsigned alignment,
+                                 unsigned section_id,
+                                 llvm::StringRef section_name) override
+    {
+        code_size_ += size;
+        return memory_.allocateCodeSection(size, alignment, section_id,
+                                           section_name);
+    }
+
+    uint8_t* allocateDataSection(uintptr_t size, unsigned alignment,
+                                 unsigned section_id,
+                                 llvm::StringRef section_name,
+                                 bool is_read_only) override
+    {
+        code_size_ += size;
+        return memory_.allocateDataSection(size, alignment, section_id,
+                                           section_name, is_read_only);
+    }
+
+    bool finalizeMemory(std::string* error_msg) override
+    {
+        return memory_.finalizeMemory(error_msg);
+    }
+
+    void registerEHFrames(uint8_t* addr, uint64_t load_addr,
+                          size_t size) override
+    {
+        memory_.registerEHFrames(addr, load_addr, size);
+    }
+
+    // Frames are deregistered along with kernel memory
+    void deregisterEHFrames() override {}
+};
+
+// Only finalized code survives compilation: IR, JIT session and linker state
+// are freed as soon as entry function address is known.
+class Jit_kernel : public Kernel {
+public:
+    // Outlives memory, which releases pages through it
+    Counting_mapper mapper;
+    std::unique_ptr<Kernel_memory> memory;
+
+    explicit Jit_kernel(std::atomic<std::size_t>& total_mapped_size)
+        : mapper{total_mapped_size}
+    {}
+};
+
+class Jit_compiler : public Compiler {
+    std::mutex cache_mutex_;
+    std::map<std::string, std::weak_ptr<const Kernel>> cache_;
+    std::atomic<std::size_t> mapped_size_{0};
+
+    std::shared_ptr<const Kernel> compile_uncached(
+        Jit_src_builder& src_builder, const Dump_info& dump_info,
+        const std::vector<const char*>& cxxflags);
+
+    void write_object_file(llvm::Module& module,
+                           const std::filesystem::path& path);
+
+public:
+    Jit_compiler();
+
+    std::shared_ptr<const Kernel> compile(
+        Jit_src_builder& src_builder, const Dump_info& dump_info,
+        const std::vector<const char*>& cxxflags) override;
+
+    void compile_to_file(
+        std::vector<Jit_src_builder>& src_builders, const Dump_info& dump_info,
+        const std::vector<const char*>& cxxflags,
+        const std::filesystem::path& output_path) override;
+
+    std::size_t memory_size() const override;
+};
+
+Jit_compiler::Jit_compiler()
+{
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+}
+
+std::shared_ptr<const Kernel> Jit_compiler::compile_uncached(
+    Jit_src_builder& src_builder, const Dump_info& dump_info,
+    const std::vector<const char*>& cxxflags)
+{
+    auto [ctx, module, entry_name_mangled, remarks]{
+        process_source(src_builder, dump_info, cxxflags)};
+
+    auto kernel{std::make_shared<Jit_kernel>(mapped_size_)};
+    kernel->remarks = std::move(remarks);
+    kernel->memory = std::make_unique<Kernel_memory>(kernel->mapper);
+
+    auto jit_ptr{check_result(
+        llvm::orc::LLJITBuilder()
+            .setObjectLinkingLayerCreator(
+                [&](llvm::orc::ExecutionSession& es, const llvm::Triple& tt) {
+                    auto layer{std::make_unique<
+                        llvm::orc::RTDyldObjectLinkingLayer>(es, [&]() {
+                        return std::make_unique<Kernel_memory_manager>(
+                            *kernel->memory, kernel->code_size);
+                    })};
+                    // Same as LLJIT does by default
+                    if (tt.isOSBinFormatCOFF()) {
+                        layer->setOverrideObjectFlagsWithResponsibilityFlags(
+                            true);
+                        layer->setAutoClaimResponsibilityForObjectSymbols(
+                            true);
+                    }
+                    return layer;
+                })
+            .create(),
+        "Failed to create JIT"s)};
+    llvm::orc::LLJIT& jit{*jit_ptr};
+
+    auto& jd{jit.getMainJITDylib()};
+    auto psg{check_result(
+        llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+            jit.getDataLayout().getGlobalPrefix()),
+        "Unable to get symbols generator"s)};
+    jd.addGenerator(std::move(psg));
+
+    if (dump_info.dump_binary()) {
+        jit.getObjTransformLayer().setTransform(
+            llvm::orc::DumpObjects{dump_info.dump_path.string(),
+                                   src_builder.user_func_name});
+    }
+    auto ts_module{llvm::orc::ThreadSafeModule{std::move(module),
+                                               std::move(ctx)}};
+    if (jit.addIRModule(jd, std::move(ts_module))) {
+        throw std::runtime_error{"Failed to add IR module to JIT"s};
+    }
+    auto symbol{check_result(
+        jit.lookupLinkerMangled(jd, entry_name_mangled),
+        "Failed to find user function symbol"s)};
+    kernel->func =
+        llvm::jitTargetAddressToPointer<Jit_src_builder::entry_func_ptr>(
+            symbol.getAddress());
+    // Code is finalized by the lookup, nothing is mapped after that
+    kernel->mapped_size = kernel->mapper.mapped_size();
+    // Everything but kernel memory goes away along with the JIT
+    return kernel;
+}
+
+std::shared_ptr<const Kernel> Jit_compiler::compile(
+    Jit_src_builder& src_builder, const Dump_info& dump_info,
+    const std::vector<const char*>& cxxflags)
+{
+    const std::string key{[&]() {
+        Jit_src_builder key_builder{src_builder};
+        // User function name is derived from user code in inline mode
+        if (key_builder.user_func_name.empty()) {
+            key_builder.user_func_name = "<inline>"s;
+        }
+        std::string key{key_builder.full_source()};
+        for (const char* cxxflag: cxxflags) {
+            key += '\0';
+            key += cxxflag;
+        }
+        return key;
+    }()};
+
+    const std::lock_guard lock{cache_mutex_};
+    // Dumps are produced during compilation only
+    if (!dump_info.any()) {
+        if (auto kernel{cache_[key].lock()}) { return kernel; }
+    }
+
+    auto kernel{compile_uncached(src_builder, dump_info, cxxflags)};
+    for (auto it{cache_.begin()}; it != cache_.end();) {
+        it = it->second.expired() ? cache_.erase(it) : std::next(it);
+    }
+    cache_[key] = kernel;
+    return kernel;
+}
+
+std::size_t Jit_compiler::memory_size() const
+{
+    return mapped_size_;
+}
+
+void Jit_compiler::write_object_file(llvm::Module& module,
+                                     const std::filesystem::path& path)
+{
+    std::string error;
+    const std::string triple{module.getTargetTriple()};
+    const llvm::Target* target{
+        llvm::TargetRegistry::lookupTarget(triple, error)};
+    if (!target) {
+        throw std::runtime_error{"Failed to find target: "s + error};
+    }
+    // Target CPU and features are taken from function attributes, which
+    // reflect cxxflags
+    std::unique_ptr<llvm::TargetMachine> target_machine{
+        target->createTargetMachine(triple, "generic", "",
+                                    llvm::TargetOptions{}, llvm::Reloc::PIC_,
+                                    llvm::None,
+                                    llvm::CodeGenOpt::Aggressive)};
+    if (!target_machine) {
+        throw std::runtime_error{"Failed to create target machine"s};
+    }
+    module.setDataLayout(target_machine->createDataLayout());
+
+    std::error_code ec;
+    llvm::raw_fd_ostream os{path.string(), ec, llvm::sys::fs::OF_None};
+    if (ec) {
+        throw std::runtime_error{"Failed to open "s + path.string() + ": "s
+                                 + ec.message()};
+    }
+    llvm::legacy::PassManager pass_manager;
+    if (target_machine->addPassesToEmitFile(pass_manager, os, nullptr,
+                                            llvm::CGFT_ObjectFile)) {
+        throw std::runtime_error{"Target can't emit object files"s};
+    }
+    pass_manager.run(module);
+}
+
+void Jit_compiler::compile_to_file(
+    std::vector<Jit_src_builder>& src_builders, const Dump_info& dump_info,
+    const std::vector<const char*>& cxxflags,
+    const std::filesystem::path& output_path)
+{
+    Expects(!src_builders.empty());
+
+    llvm::LLVMContext ctx;
+    auto library{std::make_unique<llvm::Module>("exprcpp_kernels", ctx)};
+    llvm::Linker linker{*library};
+
+    for (auto& src_builder: src_builders) {
+        auto [_, module, entry_name_mangled, remarks]{
+            process_source(src_builder, dump_info, cxxflags, &ctx)};
+        for (const auto& remark: remarks) {
+            std::cerr << "plane " << src_builder.plane << ": " << remark.text
+                      << '\n';
+        }
+
+        llvm::Function* entry{module->getFunction(entry_name_mangled)};
+        if (!entry) {
+            throw std::runtime_error{"Failed to find user function symbol"s};
+        }
+        entry->setName(Jit_src_builder::kernel_symbol(
+            src_builder.plane, src_builder.prop_value));
+        entry->setDLLStorageClass(llvm::GlobalValue::DLLExportStorageClass);
+        // Every plane brings its own copy of user code, loop function etc.
+        for (llvm::GlobalValue& value: module->global_values()) {
+            if (&value == entry || value.isDeclaration()) { continue; }
+            value.setLinkage(llvm::GlobalValue::InternalLinkage);
+            if (auto* object{llvm::dyn_cast<llvm::GlobalObject>(&value)}) {
+                object->setComdat(nullptr);
+            }
+        }
+
+        if (library->getTargetTriple().empty()) {
+            library->setTargetTriple(module->getTargetTriple());
+            library->setDataLayout(module->getDataLayout());
+        }
+        if (linker.linkInModule(std::move(module))) {
+            throw std::runtime_error{"Failed to link plane modules"s};
+        }
+    }
+
+    const std::string signature{src_builders.front().signature()};
+    auto* signature_var{new llvm::GlobalVariable{
+        *library, llvm::ArrayType::get(llvm::Type::getInt8Ty(ctx),
+                                       signature.size() + 1),
+        /* isConstant */ true, llvm::GlobalValue::ExternalLinkage,
+        llvm::ConstantDataArray::getString(ctx, signature),
+        Jit_src_builder::signature_symbol}};
+    signature_var->setDLLStorageClass(
+        llvm::GlobalValue::DLLExportStorageClass);
+
+    const auto extension{output_path.extension()};
+    if (extension == ".o" || extension == ".obj") {
+        write_object_file(*library, output_path);
+        return;
+    }
+
+    auto object_path{output_path};
+    object_path += ".o";
+    write_object_file(*library, object_path);
+    auto object_remover{gsl::finally([&]() {
+        std::error_code ec;
+        std::filesystem::remove(object_path, ec);
+    })};
+
+    llvm::raw_os_ostream llvm_cerr{std::cerr};
+    llvm::IntrusiveRefCntPtr<clang::DiagnosticOptions> diag_opts{
+        new clang::DiagnosticOptions()};
+    clang::DiagnosticsEngine diags{
+        new clang::DiagnosticIDs(), diag_opts.get(),
+        new clang::TextDiagnosticPrinter{llvm_cerr, diag_opts.get()}};
+    clang::driver::Driver driver{"clang++", library->getTargetTriple(), diags};
+
+    const std::string object_path_str{object_path.string()};
+    const std::string output_path_str{output_path.string()};
+    const llvm::SmallVector<const char*, 8> args{
+        "clang++", "-shared", object_path_str.c_str(), "-o",
+        output_path_str.c_str()};
+    std::unique_ptr<clang::driver::Compilation> compilation{
+        driver.BuildCompilation(args)};
+    llvm::SmallVector<std::pair<int, const clang::driver::Command*>, 4>
+        failing_commands;
+    if (!compilation
+        || driver.ExecuteCompilation(*compilation, failing_commands) != 0) {
+        throw std::runtime_error{
+            "Failed to link shared library. Write object file (.o or .obj) "s
+            "and link it manually instead"s};
+    }
+}
+} // namespace exprcpp
+
+exprcpp::Compiler* exprcpp_get_compiler()
+{
+    static exprcpp::Jit_compiler compiler;
+    return &compiler;
+}
\ No newline at end of file
@@ -1,59 +1,23 @@
-#include "exprcpp/ast_action.h"
+#include "exprcpp/compiler.h"
+#include "exprcpp/dump_info.h"
 #include "exprcpp/jit_src_builder.h"
+#include "exprcpp/shared_library.h"
 #include "exprcpp/support.h"
-#include <iterator>
-
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wdeprecated-declarations"
-#include <clang/Basic/Diagnostic.h>
-#include <clang/Basic/DiagnosticFrontend.h>
-#include <clang/Basic/DiagnosticIDs.h>
-#include <clang/Basic/DiagnosticOptions.h>
-#include <clang/CodeGen/CodeGenAction.h>
-#include <clang/Driver/Compilation.h>
-#include <clang/Driver/Driver.h>
-#include <clang/Driver/Job.h>
-#include <clang/Driver/Tool.h>
-#include <clang/Frontend/CompilerInstance.h>
-#include <clang/Frontend/CompilerInvocation.h>
-#include <clang/Frontend/FrontendAction.h>
-#include <clang/Frontend/TextDiagnosticPrinter.h>
-#include <llvm/ADT/IntrusiveRefCntPtr.h>
-#include <llvm/ADT/SmallVector.h>
-#include <llvm/Bitcode/BitcodeWriter.h>
-#include <llvm/ExecutionEngine/JITSymbol.h>
-#include <llvm/ExecutionEngine/Orc/DebugUtils.h>
-#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
-#include <llvm/ExecutionEngine/Orc/LLJIT.h>
-#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
-#include <llvm/IR/LLVMContext.h>
-#include <llvm/IR/Module.h>
-#include <llvm/Option/Option.h>
-#include <llvm/Support/DynamicLibrary.h>
-#include <llvm/Support/Host.h>
-#include <llvm/Support/ManagedStatic.h>
-#include <llvm/Support/raw_os_ostream.h>
-#include <llvm/Support/TargetSelect.h>
-#include <llvm/Support/VirtualFileSystem.h>
-
-// #include <clang/AST/ASTContext.h>
-// #include <clang/AST/Decl.h>
-// #include <clang/AST/DeclBase.h>
-// #include <clang/AST/DeclGroup.h>
-// #include <clang/AST/Mangle.h>
-// #include <llvm/Support/Casting.h>
-#pragma clang diagnostic pop
 
 #include <gsl/gsl>
 #include <vapoursynth/VapourSynth.h>
 
-#include <bitset>
+#include <algorithm>
+#include <array>
+#include <cstddef>
 #include <cstdint>
-#include <ctime>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <filesystem>
-#include <fstream>
-#include <iostream>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <utility>
@@ -63,149 +27,311 @@ using namespace std::literals;
 
 namespace exprcpp {
 
-class Dump_info {
+// Everything get_frame() needs, resolved once in create(), so that per-frame
+// work is limited to fetching frames and calling into JIT-compiled code.
+struct Frame_plan {
+    static constexpr gsl::index max_planes{3};
+    // Same limit as Expr has
+    static constexpr gsl::index max_srcs{26};
+    static constexpr gsl::index max_dsts{8};
+
+    gsl::index src_count{0};
+    gsl::index dst_count{1};
+    gsl::index plane_count{0};
+    std::array<Jit_src_builder::entry_func_ptr, max_planes> jit_funcs{};
+    // Planes without JIT function are copied from the first input
+    std::array<bool, max_planes> copy_planes{};
+    std::array<int, max_planes> plane_indices{0, 1, 2};
+    // Single-plane inputs feed every output plane
+    std::array<bool, max_srcs> single_plane_srcs{};
+    // Log2 of how many times inputs are smaller than output
+    std::array<std::pair<int, int>, max_srcs> src_subs{};
+    // Zero when frame dimensions are not known in advance
+    std::array<long, max_planes> widths{};
+    std::array<long, max_planes> heights{};
+    bool constant_dims{false};
+    std::vector<double> param_values;
+    // Property of the first input's frames kernels are specialized for
+    std::string prop_name;
+    std::vector<std::int64_t> prop_values;
+    // Indexed the same as prop_values. Generic kernel from jit_funcs is used
+    // for unexpected values and for missing variants.
+    std::array<std::vector<Jit_src_builder::entry_func_ptr>, max_planes>
+        variant_funcs;
+};
+
+// Kernel from a library compiled ahead of time
+class Library_kernel : public Kernel {
+public:
+    std::shared_ptr<const Shared_library> library;
+};
+
+// Multi-output kernels produce frames of every output at once. Frames that
+// weren't requested yet wait here, until the cache grows too large. Requests
+// for other outputs of a frame being computed wait for it.
+class Output_cache {
 public:
-    std::filesystem::path dump_path;
+    using Frames = std::array<const VSFrameRef*, Frame_plan::max_dsts>;
 
-    Dump_info(const VSAPI& vsapi, const VSMap& vsmap)
+private:
+    struct Entry {
+        int n;
+        Frames frames;
+    };
+
+    std::mutex mutex_;
+    std::condition_variable computed_;
+    std::deque<Entry> entries_;
+    // Frames which outputs are being computed
+    std::vector<int> in_flight_;
+    gsl::index max_size_{1};
+
+    static void free_frames(const Entry& entry, const VSAPI& vsapi)
     {
-        int err{0};
-        auto get_bool_value{[&](const std::string& name, bool fallback) {
-            if (bool value{static_cast<bool>(
-                    vsapi.propGetInt(&vsmap, name.c_str(), 0, &err))}; !err) {
-                return value;
-            }
-            return fallback;
-        }};
+        for (const auto* frame: entry.frames) { vsapi.freeFrame(frame); }
+    }
 
-        dump_source( get_bool_value("dump_source"s,  false));
-        dump_bitcode(get_bool_value("dump_bitcode"s, false));
-        dump_binary( get_bool_value("dump_binary"s,  false));
+    const VSFrameRef* take_locked(int n, gsl::index output)
+    {
+        const auto it{std::find_if(entries_.begin(), entries_.end(),
+                                   [n](const Entry& entry) {
+            return entry.n == n;
+        })};
+        if (it == entries_.end()) { return nullptr; }
+        const VSFrameRef* frame{std::exchange(it->frames[output], nullptr)};
+        if (std::all_of(it->frames.cbegin(), it->frames.cend(),
+                        [](const auto* f) { return f == nullptr; })) {
+            entries_.erase(it);
+        }
+        return frame;
+    }
 
-        this->dump_path = [&]() -> std::filesystem::path {
-            const char* path_c{vsapi.propGetData(&vsmap, "dump_path", 0, &err)};
-            if (err) {
-                auto path{std::filesystem::current_path()};
-                if (flags_.any()) {
-                    vsapi.logMessage(
-                        mtWarning, ("expr_cpp: using CWD for dumping: "s
-                                    + path.string()).c_str());
-                }
-                return path;
-            }
-            return {path_c};
-        }();
+public:
+    // Number of frames whose outputs wait to be requested
+    void max_size(gsl::index size)
+    {
+        max_size_ = std::max(size, gsl::index{1});
+    }
 
+    // Returns null if there is no such frame
+    const VSFrameRef* take(int n, gsl::index output)
+    {
+        const std::lock_guard lock{mutex_};
+        return take_locked(n, output);
     }
 
-    bool dump_source() const  { return flags_[0]; }
-    bool dump_bitcode() const { return flags_[1]; }
-    bool dump_binary() const  { return flags_[2]; }
+    // Waits until frame n is not being computed by another thread. Returns
+    // null if there is no such frame, in which case frame n is reserved for
+    // the caller to compute, put() and release().
+    const VSFrameRef* take_or_reserve(int n, gsl::index output)
+    {
+        std::unique_lock lock{mutex_};
+        while (true) {
+            if (const auto* frame{take_locked(n, output)}) { return frame; }
+            if (std::find(in_flight_.cbegin(), in_flight_.cend(), n)
+                == in_flight_.cend()) {
+                break;
+            }
+            computed_.wait(lock);
+        }
+        in_flight_.push_back(n);
+        return nullptr;
+    }
 
-    void dump_source(bool value)  { flags_[0] = value; }
-    void dump_bitcode(bool value) { flags_[1] = value; }
-    void dump_binary(bool value)  { flags_[2] = value; }
+    void release(int n)
+    {
+        {
+            const std::lock_guard lock{mutex_};
+            in_flight_.erase(
+                std::find(in_flight_.cbegin(), in_flight_.cend(), n));
+        }
+        computed_.notify_all();
+    }
 
-private:
-    std::bitset<3> flags_;
-};
+    // Takes ownership of frames
+    void put(int n, const Frames& frames, const VSAPI& vsapi)
+    {
+        const std::lock_guard lock{mutex_};
+        auto it{std::find_if(entries_.begin(), entries_.end(),
+                             [n](const Entry& entry) {
+            return entry.n == n;
+        })};
+        if (it == entries_.end()) {
+            it = entries_.insert(entries_.end(), Entry{n, {}});
+        }
+        for (gsl::index i{0}; i != ssize(frames); ++i) {
+            // Same output could have been requested twice
+            if (!it->frames[i]) {
+                it->frames[i] = frames[i];
+            } else {
+                vsapi.freeFrame(frames[i]);
+            }
+        }
+        while (ssize(entries_) > max_size_) {
+            free_frames(entries_.front(), vsapi);
+            entries_.pop_front();
+        }
+    }
 
+    void clear(const VSAPI& vsapi)
+    {
+        for (const auto& entry: entries_) { free_frames(entry, vsapi); }
+        entries_.clear();
+    }
+};
 
 struct Exprcpp_data {
     std::vector<VSNodeRef*> srcs;
-    VSVideoInfo* dst_info;
-    std::vector<std::pair<VSNodeRef*, int>> dst_init;
-    std::vector<Jit_src_builder::entry_func_type> jit_funcs;
-    std::unique_ptr<llvm::orc::LLJIT> jit;
+    std::vector<VSVideoInfo> dst_infos;
+    Frame_plan plan;
+    std::vector<std::shared_ptr<const Kernel>> kernels;
+    Output_cache output_cache;
 };
 
 void VS_CC init(VSMap*, VSMap*, void** instance_data, VSNode* node, VSCore*,
                 const VSAPI* vsapi)
 {
     const auto* data{static_cast<const Exprcpp_data*>(*instance_data)};
-    vsapi->setVideoInfo(data->dst_info, 1, node);
+    vsapi->setVideoInfo(data->dst_infos.data(),
+                        gsl::narrow_cast<int>(ssize(data->dst_infos)), node);
 }
 
 const VSFrameRef *VS_CC get_frame(
     int n, int activationReason, void** instance_data, void**,
     VSFrameContext* frame_ctx, VSCore* core, const VSAPI* vsapi)
 {
-    const auto* data{static_cast<const Exprcpp_data*>(*instance_data)};
+    auto* data{static_cast<Exprcpp_data*>(*instance_data)};
+    const Frame_plan& plan{data->plan};
+    const int output{plan.dst_count > 1 ? vsapi->getOutputIndex(frame_ctx)
+                                        : 0};
 
     if (activationReason == arInitial) {
+        if (plan.dst_count > 1) {
+            if (const auto* frame{data->output_cache.take(n, output)}) {
+                return frame;
+            }
+        }
         for (auto* src: data->srcs) {
             vsapi->requestFrameFilter(n, src, frame_ctx);
         }
     } else if (activationReason == arAllFramesReady) {
-        Expects(!data->dst_init.empty());
-        Expects(!data->jit_funcs.empty());
-
-        auto src_frames{[&]() {
-            std::vector<const VSFrameRef*> src_frames;
-            src_frames.reserve(ssize(data->srcs));
-            for (auto* node: data->srcs) {
-                src_frames.push_back(vsapi->getFrameFilter(n, node, frame_ctx));
+        Expects(plan.src_count > 0);
+
+        // Only one thread computes outputs of a frame, others take theirs
+        // from the cache
+        if (plan.dst_count > 1) {
+            if (const auto* frame{
+                    data->output_cache.take_or_reserve(n, output)}) {
+                return frame;
             }
-            return src_frames;
-        }()};
-        auto src_frames_cleaner{gsl::finally(
-            [&]() { clean_frames(vsapi, src_frames); })};
-
-        VSFrameRef* const dst_frame{[&]() {
-            std::vector<const VSFrameRef*> copy_src_frames;
-            std::vector<int> copy_src_planes;
-            for (const auto& [node, plane]: data->dst_init) {
-                const VSFrameRef* frame{nullptr};
-                if (node) {
-                    frame = vsapi->getFrameFilter(n, node, frame_ctx);
+        }
+        auto reservation_releaser{gsl::finally([&]() {
+            if (plan.dst_count > 1) { data->output_cache.release(n); }
+        })};
+
+        std::array<const VSFrameRef*, Frame_plan::max_srcs> src_frames{};
+        auto src_frames_cleaner{gsl::finally([&]() {
+            for (gsl::index i{0}; i != plan.src_count; ++i) {
+                vsapi->freeFrame(src_frames[i]);
+            }
+        })};
+        for (gsl::index i{0}; i != plan.src_count; ++i) {
+            src_frames[i] = vsapi->getFrameFilter(n, data->srcs[i], frame_ctx);
+        }
+
+        const int width{vsapi->getFrameWidth(src_frames[0], 0)};
+        const int height{vsapi->getFrameHeight(src_frames[0], 0)};
+        if (!plan.constant_dims) {
+            for (gsl::index i{1}; i != plan.src_count; ++i) {
+                const auto [sub_w, sub_h]{plan.src_subs[i]};
+                if (vsapi->getFrameWidth(src_frames[i], 0) << sub_w != width
+                    || vsapi->getFrameHeight(src_frames[i], 0) << sub_h
+                       != height) {
+                    const std::string message{
+                        "expr_cpp: frame "s + std::to_string(n)
+                        + " of input clip #"s + std::to_string(i)
+                        + " has dimensions incompatible with output frame"s};
+                    vsapi->setFilterError(message.c_str(), frame_ctx);
+                    return nullptr;
                 }
-                copy_src_frames.push_back(frame);
-                copy_src_planes.push_back(plane);
             }
-            auto copy_src_frames_cleaner{gsl::finally(
-                [&]() { clean_frames(vsapi, copy_src_frames); })};
-
-            return vsapi->newVideoFrame2(
-                data->dst_info->format, vsapi->getFrameWidth(src_frames[0], 0),
-                vsapi->getFrameHeight(src_frames[0], 0), copy_src_frames.data(),
-                copy_src_planes.data(), src_frames[0], core);
-        }()};
-
-        for (gsl::index plane{0}; plane != data->dst_info->format->numPlanes;
-                                                                      ++plane) {
-            const auto jit_func{data->jit_funcs[plane]};
-            if (!jit_func) { continue; }
+        }
 
-            const long pixel_count{vsapi->getFrameWidth(dst_frame, plane)
-                                   * vsapi->getFrameHeight(dst_frame, plane)};
+        std::array<const VSFrameRef*, Frame_plan::max_planes> copy_src_frames{};
+        for (gsl::index plane{0}; plane != plan.plane_count; ++plane) {
+            if (plan.copy_planes[plane]) {
+                copy_src_frames[plane] = src_frames[0];
+            }
+        }
+        std::array<VSFrameRef*, Frame_plan::max_dsts> dst_frames{};
+        for (gsl::index i{0}; i != plan.dst_count; ++i) {
+            dst_frames[i] = vsapi->newVideoFrame2(
+                data->dst_infos[i].format, width, height,
+                copy_src_frames.data(), plan.plane_indices.data(),
+                src_frames[0], core);
+        }
 
-            for (gsl::index i{0}; i != ssize(src_frames); ++i) {
-                const long src_pixel_count{
-                    vsapi->getFrameWidth(src_frames[i], plane)
-                    * vsapi->getFrameHeight(src_frames[i], plane)};
-                if (src_pixel_count != pixel_count) {
-                    throw std::runtime_error{
-                        "Frame "s + std::to_string(n) + " of input clip #"s
-                        + std::to_string(i) + " has different number of pixels"s
-                        "than output frame"s};
-                }
+        std::int64_t prop_value{0};
+        gsl::index variant{-1};
+        if (!plan.prop_name.empty()) {
+            int err{0};
+            prop_value = vsapi->propGetInt(
+                vsapi->getFramePropsRO(src_frames[0]), plan.prop_name.c_str(),
+                0, &err);
+            if (err) {
+                prop_value = 0;
+            } else if (const auto it{std::find(plan.prop_values.cbegin(),
+                                               plan.prop_values.cend(),
+                                               prop_value)};
+                       it != plan.prop_values.cend()) {
+                variant = it - plan.prop_values.cbegin();
             }
+        }
 
-            auto data_ptrs{[&]() {
-                std::vector<void*> data_ptrs{
-                    vsapi->getWritePtr(dst_frame, plane)};
-                data_ptrs.reserve(ssize(data->srcs) + 1);
-                for (const auto* src_frame: src_frames) {
-                    data_ptrs.push_back(const_cast<uint8_t*>(
-                        vsapi->getReadPtr(src_frame, plane)));
-                }
-                return data_ptrs;
-            }()};
+        std::array<void*, Frame_plan::max_dsts + Frame_plan::max_srcs>
+            data_ptrs{};
+        std::array<long, Frame_plan::max_dsts + Frame_plan::max_srcs>
+            strides{};
+        for (gsl::index plane{0}; plane != plan.plane_count; ++plane) {
+            auto jit_func{plan.jit_funcs[plane]};
+            if (!jit_func) { continue; }
+            if (variant != -1 && plan.variant_funcs[plane][variant]) {
+                jit_func = plan.variant_funcs[plane][variant];
+            }
+
+            const long plane_width{plan.constant_dims
+                                   ? plan.widths[plane]
+                                   : vsapi->getFrameWidth(dst_frames[0],
+                                                          plane)};
+            const long plane_height{plan.constant_dims
+                                    ? plan.heights[plane]
+                                    : vsapi->getFrameHeight(dst_frames[0],
+                                                            plane)};
+
+            for (gsl::index i{0}; i != plan.dst_count; ++i) {
+                data_ptrs[i] = vsapi->getWritePtr(dst_frames[i], plane);
+                strides[i] = vsapi->getStride(dst_frames[i], plane);
+            }
+            for (gsl::index i{0}; i != plan.src_count; ++i) {
+                const int src_plane{plan.single_plane_srcs[i]
+                                    ? 0 : gsl::narrow_cast<int>(plane)};
+                data_ptrs[plan.dst_count + i] = const_cast<uint8_t*>(
+                    vsapi->getReadPtr(src_frames[i], src_plane));
+                strides[plan.dst_count + i] =
+                    vsapi->getStride(src_frames[i], src_plane);
+            }
 
-            jit_func(pixel_count, data_ptrs.data());
+            jit_func(plane_width, plane_height, strides.data(),
+                     data_ptrs.data(), plan.param_values.data(), prop_value);
         }
 
-        return dst_frame;
+        if (plan.dst_count == 1) { return dst_frames[0]; }
+        Output_cache::Frames other_frames{};
+        for (gsl::index i{0}; i != plan.dst_count; ++i) {
+            if (i != output) { other_frames[i] = dst_frames[i]; }
+        }
+        data->output_cache.put(n, other_frames, *vsapi);
+        return dst_frames[output];
     }
 
     return 0;
@@ -213,163 +339,30 @@ const VSFrameRef *VS_CC get_frame(
 
 void VS_CC free(void* instance_data, VSCore*, const VSAPI* vsapi)
 {
-    const auto* data{static_cast<Exprcpp_data*>(instance_data)};
+    auto* data{static_cast<Exprcpp_data*>(instance_data)};
+    data->output_cache.clear(*vsapi);
     for (auto* src : data->srcs) {
         vsapi->freeNode(src);
     }
     delete data;
-    llvm::llvm_shutdown();
 }
 
-Jit_src_builder::entry_func_type process_source(
-    llvm::orc::LLJIT& jit, Jit_src_builder& src_builder,
-    const Dump_info dump_info, const gsl::index plane,
-    const std::vector<const char*>& cxxflags = {"-O3", "-std=c++17",
-    "-march=native"})
+// Clang and LLVM are loaded on first use only
+Compiler& get_compiler()
 {
-    llvm::IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> mem_vfs{
-        new llvm::vfs::InMemoryFileSystem{}};
-    llvm::IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> vfs{
-        new llvm::vfs::OverlayFileSystem{mem_vfs}};
-    vfs->pushOverlay(llvm::vfs::getRealFileSystem());
-
-    llvm::raw_os_ostream llvm_cout{std::cout};
-
-    llvm::IntrusiveRefCntPtr<clang::DiagnosticOptions> diag_opts{
-        new clang::DiagnosticOptions()};
-    clang::TextDiagnosticPrinter* diag_client{
-        new clang::TextDiagnosticPrinter{llvm_cout, diag_opts.get()}};
-    llvm::IntrusiveRefCntPtr<clang::DiagnosticIDs> diag_id{
-        new clang::DiagnosticIDs()};
-    clang::DiagnosticsEngine diags{diag_id, diag_opts.get(), diag_client};
-
-    auto build_compiler_invocation{[&](const std::string& file_name) {
-        clang::driver::Driver driver{"clang++", llvm::sys::getProcessTriple(),
-                                     diags, vfs};
-
-        llvm::SmallVector<const char*, 20> args{
-            "clang++", file_name.c_str(), "-fsyntax-only"};
-        args.append(cxxflags.cbegin(), cxxflags.cend());
-        std::unique_ptr<clang::driver::Compilation> compilation{
-            driver.BuildCompilation(args)};
-        if (!compilation) {
-            throw std::runtime_error{"Failed to create compilation"s};
-        }
-
-        const clang::driver::JobList& jobs{compilation->getJobs()};
-        if (ssize(jobs) != 1
-            || !clang::isa<clang::driver::Command>(*jobs.begin()))
-        {
-            throw std::runtime_error{"Failed to create job list"s};
-        }
-        const clang::driver::Command& cmd{
-            llvm::cast<clang::driver::Command>(*jobs.begin())};
-        const llvm::opt::ArgStringList& cc_args{cmd.getArguments()};
-        auto ci{std::make_unique<clang::CompilerInvocation>()};
-        clang::CompilerInvocation::CreateFromArgs(*ci, cc_args, diags);
-        return ci;
-    }};
-
-    clang::CompilerInstance ci{};
-    ci.createFileManager(vfs);
-    if (!ci.hasFileManager()) {
-        throw std::runtime_error{
-            "Failed to create file manager from virtual FS"s};
-    }
-
-    auto execute_action{[&ci](clang::FrontendAction& action) {
-        ci.createDiagnostics();
-        if (!ci.hasDiagnostics()) {
-            throw std::runtime_error{"Failed to create diagnostics engine"s};
-        }
-        ci.resetAndLeakSourceManager();
-        if (!ci.ExecuteAction(action)) {
-            throw std::runtime_error{"Failed to execute frontend action"s};
-        }
-    }};
-
-    if (src_builder.user_func_name.empty()) {
-        mem_vfs->addFile(
-            "expr.cpp", std::time(nullptr),
-            llvm::MemoryBuffer::getMemBuffer(src_builder.user_code()));
-        ci.setInvocation(build_compiler_invocation("expr.cpp"s));
-
-        std::string user_func_name{};
-        {
-            std::string _;
-            Name_extractor_action name_action{user_func_name, _};
-            execute_action(name_action);
+    static Compiler* const compiler{[]() {
+        static const Shared_library library{
+            Shared_library::current_module_dir() / "exprcpp"
+            / EXPRCPP_JIT_LIBRARY};
+        const auto get_compiler_func{
+            reinterpret_cast<decltype(&exprcpp_get_compiler)>(
+                library.symbol("exprcpp_get_compiler"))};
+        if (!get_compiler_func) {
+            throw std::runtime_error{"Failed to find compiler entry point"s};
         }
-        if (user_func_name.empty()) {
-            throw std::runtime_error{"User function not found"s};
-        }
-        src_builder.user_func_name = user_func_name;
-    }
-
-    std::string jit_source{src_builder.full_source()};
-
-    if (dump_info.dump_source()) {
-        std::ofstream ofs{dump_info.dump_path
-                          / (src_builder.user_func_name + "_dump.cpp"s)};
-        ofs << jit_source;
-    }
-
-    mem_vfs->addFile("expr_full.cpp", std::time(nullptr),
-                     llvm::MemoryBuffer::getMemBuffer(jit_source));
-
-    ci.setInvocation(build_compiler_invocation("expr_full.cpp"s));
-
-    std::string entry_name_mangled;
-    {
-        std::string _;
-        Name_extractor_action name_action{_, entry_name_mangled};
-        execute_action(name_action);
-    }
-
-    clang::EmitLLVMOnlyAction main_action{};
-    execute_action(main_action);
-
-    std::unique_ptr<llvm::LLVMContext> ctx{main_action.takeLLVMContext()};
-    std::unique_ptr<llvm::Module> module{main_action.takeModule()};
-    if (!module) { throw std::runtime_error{"Failed to create module"s}; }
-
-    if (dump_info.dump_bitcode()) {
-        std::ofstream ofs{dump_info.dump_path
-                          / (src_builder.user_func_name + "_dump.bc"s),
-                          std::ofstream::binary};
-        llvm::raw_os_ostream os{ofs};
-        WriteBitcodeToFile(*module, os);
-    }
-
-    auto& jd{check_result(jit.createJITDylib(std::to_string(plane)),
-                          "Failed to create JITDylib"s)};
-    auto psg{check_result(
-        llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
-            jit.getDataLayout().getGlobalPrefix()),
-        "Unable to get symbols generator"s)};
-    jd.addGenerator(std::move(psg));
-
-    if (dump_info.dump_binary()) {
-        jit.getObjTransformLayer().setTransform(
-            llvm::orc::DumpObjects{dump_info.dump_path.string(),
-                                   src_builder.user_func_name});
-    }
-    auto disable_object_dumper{gsl::finally([&]() {
-        if (dump_info.dump_binary()) {
-            jit.getObjTransformLayer().setTransform(nullptr);
-        }
-    })};
-
-    auto ts_module{llvm::orc::ThreadSafeModule{std::move(module),
-                                               std::move(ctx)}};
-    if (jit.addIRModule(jd, std::move(ts_module))) {
-        throw std::runtime_error{"Failed to add IR module to JIT"s};
-    }
-    auto symbol{check_result(
-        jit.lookupLinkerMangled(jd, entry_name_mangled),
-        "Failed to find user function symbol"s)};
-    return llvm::jitTargetAddressToPointer<Jit_src_builder::entry_func_ptr>(
-        symbol.getAddress());
+        return get_compiler_func();
+    }()};
+    return *compiler;
 }
 
 void VS_CC create(const VSMap* in, VSMap* out, void*, VSCore* core,
@@ -392,27 +385,102 @@ void VS_CC create(const VSMap* in, VSMap* out, void*, VSCore* core,
         data->srcs.push_back(node);
     }
     if (data->srcs.empty()) { throw std::runtime_error{"No input clips"s}; }
+    if (ssize(data->srcs) > Frame_plan::max_srcs) {
+        throw std::runtime_error{"Too many input clips, maximum is "s
+                                 + std::to_string(Frame_plan::max_srcs)};
+    }
 
-    data->dst_info =
-        const_cast<VSVideoInfo*>(vsapi->getVideoInfo(data->srcs[0]));
-    if (int64_t fmt_idx{vsapi->propGetInt(in, "format", 0, &err)}; !err) {
+    Frame_plan& plan{data->plan};
+    if (const int64_t outputs{vsapi->propGetInt(in, "outputs", 0, &err)};
+        !err) {
+        if (outputs < 1 || outputs > Frame_plan::max_dsts) {
+            throw std::runtime_error{"Number of outputs must be from 1 to "s
+                                     + std::to_string(Frame_plan::max_dsts)};
+        }
+        plan.dst_count = outputs;
+    }
+    // Every thread leaves frames of other outputs behind, and those can be
+    // requested a while later when outputs are consumed out of step
+    data->output_cache.max_size(2 * vsapi->getCoreInfo(core)->numThreads);
+    // As with code, missing format means the last one
+    const int fmt_count{vsapi->propNumElements(in, "format")};
+    for (gsl::index i{0}; i != plan.dst_count; ++i) {
+        VSVideoInfo& dst_info{data->dst_infos.emplace_back(
+            *vsapi->getVideoInfo(data->srcs[0]))};
+        if (fmt_count <= 0) { continue; }
+        const int64_t fmt_idx{vsapi->propGetInt(
+            in, "format", std::min<gsl::index>(i, fmt_count - 1), &err)};
         // TODO: add format checks if necessary
-        data->dst_info->format = vsapi->getFormatPreset(fmt_idx, core);
+        dst_info.format = vsapi->getFormatPreset(
+            gsl::narrow_cast<int>(fmt_idx), core);
+        if (!dst_info.format) {
+            throw std::runtime_error{"Unknown output format: "s
+                                     + std::to_string(fmt_idx)};
+        }
     }
-    for (const auto& fmt: src_fmts) {
-        if (fmt->numPlanes != data->dst_info->format->numPlanes) {
+    const VSFormat* dst_fmt{data->dst_infos[0].format};
+    for (const auto& dst_info: data->dst_infos) {
+        if (dst_info.format->numPlanes != dst_fmt->numPlanes
+            || dst_info.format->subSamplingW != dst_fmt->subSamplingW
+            || dst_info.format->subSamplingH != dst_fmt->subSamplingH) {
             throw std::runtime_error{
-                "All inputs must have the same number of planes"s};
+                "Outputs must have the same number of planes and "s
+                "subsampling"s};
         }
-        if (fmt->subSamplingH != data->dst_info->format->subSamplingH
-            || fmt->subSamplingW != data->dst_info->format->subSamplingW) {
+    }
+    for (const auto& fmt: src_fmts) {
+        if (fmt->numPlanes != 1 && fmt->numPlanes != dst_fmt->numPlanes) {
             throw std::runtime_error{
-                "All inputs mush have the same subsampling"s};
+                "Inputs must have either one plane or the same number of "s
+                "planes as output"s};
         }
     }
 
+    // Single-plane inputs can be smaller than output, e.g. chroma planes, so
+    // that chroma can take part in luma computation. Inputs of variable
+    // dimensions are checked frame by frame.
+    const VSVideoInfo& dst_vi{data->dst_infos[0]};
+    for (gsl::index i{0}; i != ssize(data->srcs); ++i) {
+        const VSVideoInfo* vi{vsapi->getVideoInfo(data->srcs[i])};
+        if (vi->width == 0 || vi->height == 0 || dst_vi.width == 0
+            || dst_vi.height == 0) {
+            continue;
+        }
+        auto sub_of{[&](int src_dim, int dst_dim) {
+            const int max_sub{src_fmts[i]->numPlanes == 1 ? 4 : 0};
+            for (int sub{0}; sub <= max_sub; ++sub) {
+                if (src_dim << sub == dst_dim) { return sub; }
+            }
+            throw std::runtime_error{
+                "Input clip #"s + std::to_string(i) + " has dimensions "s
+                "incompatible with output"s};
+        }};
+        plan.src_subs[i] = {sub_of(vi->width, dst_vi.width),
+                            sub_of(vi->height, dst_vi.height)};
+    }
+
     Jit_src_builder src_builder_common{src_fmts};
-    src_builder_common.dst_fmt = data->dst_info->format;
+    src_builder_common.dst_fmt = dst_fmt;
+    src_builder_common.single_plane_subs.assign(
+        plan.src_subs.cbegin(), plan.src_subs.cbegin() + ssize(data->srcs));
+    for (gsl::index i{1}; i != plan.dst_count; ++i) {
+        src_builder_common.extra_dst_fmts.push_back(data->dst_infos[i].format);
+    }
+    if (const char* resample{vsapi->propGetData(in, "resample", 0, &err)};
+        !err) {
+        if (resample == "nearest"s) {
+            src_builder_common.resample = Jit_src_builder::Resample::nearest;
+        } else if (resample == "average"s) {
+            src_builder_common.resample = Jit_src_builder::Resample::average;
+        } else {
+            throw std::runtime_error{"Unknown resample mode: "s + resample};
+        }
+    }
+    src_builder_common.padded =
+        vsapi->propGetInt(in, "padded", 0, &err) != 0;
+    if (const char* scan{vsapi->propGetData(in, "scan", 0, &err)}; !err) {
+        src_builder_common.scan = Jit_src_builder::parse_scan(scan);
+    }
 
     const auto source_path{[&]() {
         const char* path_c_str{vsapi->propGetData(in, "source_path", 0, &err)};
@@ -436,6 +504,32 @@ void VS_CC create(const VSMap* in, VSMap* out, void*, VSCore* core,
         src_builder_common.user_code(source_path);
     }
 
+    if (const int param_count{vsapi->propNumElements(in, "param_names")};
+        param_count > 0) {
+        if (param_count != vsapi->propNumElements(in, "param_values")) {
+            throw std::runtime_error{
+                "Numbers of parameter names and values don't match"s};
+        }
+        for (gsl::index i{0}; i != param_count; ++i) {
+            src_builder_common.param_names.push_back(
+                vsapi->propGetData(in, "param_names", i, &err));
+            plan.param_values.push_back(
+                vsapi->propGetFloat(in, "param_values", i, &err));
+        }
+    } else if (vsapi->propNumElements(in, "param_values") > 0) {
+        throw std::runtime_error{"Parameter values are given without names"s};
+    }
+
+    if (const char* prop{vsapi->propGetData(in, "prop", 0, &err)}; !err) {
+        src_builder_common.prop_name = prop;
+        plan.prop_name = prop;
+    }
+    for (gsl::index i{0}; i < vsapi->propNumElements(in, "prop_values"); ++i) {
+        plan.prop_values.push_back(
+            vsapi->propGetInt(in, "prop_values", i, &err));
+    }
+    src_builder_common.check_user_names(plan.prop_values);
+
     Dump_info dump_info{*vsapi, *in};
 
     bool user_cxxflags_present{false};
@@ -452,44 +546,205 @@ void VS_CC create(const VSMap* in, VSMap* out, void*, VSCore* core,
         return user_cxxflags;
     }()};
 
-    llvm::InitializeNativeTarget();
-    llvm::InitializeNativeTargetAsmPrinter();
-    auto jit{check_result(llvm::orc::LLJITBuilder().create(),
-                          "Failed to create JIT"s)};
+    auto cxxflags{user_cxxflags_present ? user_cxxflags : default_cxxflags};
+    const bool remarks{vsapi->propGetInt(in, "remarks", 0, &err) != 0};
+    if (remarks) {
+        cxxflags.insert(cxxflags.cend(), remark_cxxflags.cbegin(),
+                        remark_cxxflags.cend());
+    }
 
-    for (gsl::index i{0}; i != data->dst_info->format->numPlanes; ++i) {
-        const char* user_code_c_str{vsapi->propGetData(in, "code", i, &err)};
-        if (err) {
-            data->jit_funcs.push_back(
-                data->jit_funcs[ssize(data->jit_funcs) - 1]);
-            data->dst_init.push_back(
-                {data->dst_init[ssize(data->dst_init) - 1].first, i});
-            continue;
+    const auto kernel_library{[&]() -> std::shared_ptr<const Shared_library> {
+        const char* path{vsapi->propGetData(in, "kernel_path", 0, &err)};
+        if (err) { return nullptr; }
+        auto library{std::make_shared<const Shared_library>(
+            std::filesystem::path{path})};
+        const auto* signature{static_cast<const char*>(
+            library->symbol(Jit_src_builder::signature_symbol))};
+        if (!signature) {
+            throw std::runtime_error{"Kernel library has no signature"s};
         }
-        std::string user_code{user_code_c_str};
-        if (user_code.empty()) {
-            data->jit_funcs.emplace_back(nullptr);
-            data->dst_init.push_back({data->srcs[0], i});
-            continue;
+        if (signature != src_builder_common.signature()) {
+            throw std::runtime_error{
+                "Kernel library was compiled with different arguments: "s
+                + signature};
         }
+        return library;
+    }()};
+    if (!kernel_library && vsapi->propNumElements(in, "code") <= 0) {
+        throw std::runtime_error{"Either code or kernel_path is required"s};
+    }
+    if (kernel_library && (vsapi->propNumElements(in, "code") > 0
+                           || !source_path.empty())) {
+        throw std::runtime_error{
+            "code and source_path can't be used with kernel_path"s};
+    }
+
+    plan.src_count = ssize(data->srcs);
+    plan.plane_count = dst_fmt->numPlanes;
+    for (gsl::index i{0}; i != plan.src_count; ++i) {
+        plan.single_plane_srcs[i] = src_fmts[i]->numPlanes == 1;
+    }
+    auto add_kernel{[&](std::shared_ptr<const Kernel> kernel) {
+        const auto func{kernel->func};
+        data->kernels.push_back(std::move(kernel));
+        return func;
+    }};
+    // Returns null if library has no such kernel
+    auto load_kernel{[&](gsl::index plane,
+                         std::optional<std::int64_t> prop_value)
+                     -> Jit_src_builder::entry_func_ptr {
+        const std::string name{Jit_src_builder::kernel_symbol(
+            gsl::narrow_cast<int>(plane), prop_value)};
+        void* symbol{kernel_library->symbol(name.c_str())};
+        if (!symbol) { return nullptr; }
+        auto kernel{std::make_shared<Library_kernel>()};
+        kernel->library = kernel_library;
+        kernel->func =
+            reinterpret_cast<Jit_src_builder::entry_func_ptr>(symbol);
+        return add_kernel(std::move(kernel));
+    }};
+    auto compile_kernel{[&](const std::string& user_code,
+                            std::optional<std::int64_t> prop_value) {
         Jit_src_builder src_builder{src_builder_common};
+        src_builder.prop_value = prop_value;
         if (!source_path.empty()) {
             src_builder.user_func_name = user_code;
         } else {
             src_builder.user_code(user_code);
         }
-        auto jit_func{[&]() {
-            if (user_cxxflags_present) {
-                return process_source(*jit, src_builder, dump_info, i,
-                                      user_cxxflags);
+        auto kernel{get_compiler().compile(src_builder, dump_info, cxxflags)};
+        if (remarks && !kernel->remarks.empty()) {
+            bool missed{false};
+            std::string message{"expr_cpp: remarks for plane "s
+                                + std::to_string(src_builder.plane)};
+            if (prop_value) {
+                message += " with "s + plan.prop_name + " = "s
+                           + std::to_string(*prop_value);
+            }
+            message += ":"s;
+            for (const auto& remark: kernel->remarks) {
+                message += "\n"s + remark.text;
+                missed = missed || remark.missed;
+            }
+            // Missed vectorization is what users have to notice
+            vsapi->logMessage(missed ? mtWarning : mtDebug, message.c_str());
+        }
+        return add_kernel(std::move(kernel));
+    }};
+
+    std::string user_code;
+    for (gsl::index i{0}; i != plan.plane_count; ++i) {
+        src_builder_common.plane = gsl::narrow_cast<int>(i);
+        if (kernel_library) {
+            // Planes without kernels are copied
+            if (const auto func{load_kernel(i, std::nullopt)}) {
+                plan.jit_funcs[i] = func;
+                for (const auto value: plan.prop_values) {
+                    plan.variant_funcs[i].push_back(load_kernel(i, value));
+                }
+                continue;
+            }
+            user_code.clear();
+        } else if (const char* user_code_c_str{
+                       vsapi->propGetData(in, "code", i, &err)}; err) {
+            // Previous plane can be reused as long as inputs are resampled
+            // the same way
+            const bool same_shifts{[&]() {
+                Jit_src_builder prev_builder{src_builder_common};
+                prev_builder.plane = gsl::narrow_cast<int>(i - 1);
+                for (gsl::index j{0}; j != plan.src_count; ++j) {
+                    if (prev_builder.src_shift_w(j)
+                            != src_builder_common.src_shift_w(j)
+                        || prev_builder.src_shift_h(j)
+                           != src_builder_common.src_shift_h(j)) {
+                        return false;
+                    }
+                }
+                return true;
+            }()};
+            if (same_shifts
+                && !(plan.copy_planes[i - 1] && plan.single_plane_srcs[0])) {
+                plan.jit_funcs[i] = plan.jit_funcs[i - 1];
+                plan.variant_funcs[i] = plan.variant_funcs[i - 1];
+                plan.copy_planes[i] = plan.copy_planes[i - 1];
+                continue;
+            }
+        } else {
+            user_code = user_code_c_str;
+        }
+        if (user_code.empty()) {
+            if ((i != 0 && plan.single_plane_srcs[0])
+                || src_builder_common.src_shift_w(0) != 0
+                || src_builder_common.src_shift_h(0) != 0) {
+                throw std::runtime_error{
+                    "Plane "s + std::to_string(i) + " can't be copied from "s
+                    "the first input, because it has different subsampling"s};
+            }
+            for (gsl::index j{0}; j != plan.dst_count; ++j) {
+                const VSFormat* fmt{data->dst_infos[j].format};
+                if (fmt->sampleType != src_fmts[0]->sampleType
+                    || fmt->bitsPerSample != src_fmts[0]->bitsPerSample) {
+                    throw std::runtime_error{
+                        "Plane "s + std::to_string(i) + " can't be copied "s
+                        "from the first input into output "s
+                        + std::to_string(j) + ", because it has different "s
+                        "sample type or bit depth"s};
+                }
+            }
+            plan.copy_planes[i] = true;
+            continue;
+        }
+        plan.jit_funcs[i] = compile_kernel(user_code, std::nullopt);
+        for (const auto value: plan.prop_values) {
+            plan.variant_funcs[i].push_back(compile_kernel(user_code, value));
+        }
+    }
+
+    const bool report_memory{
+        vsapi->propGetInt(in, "report_memory", 0, &err) != 0};
+    if (report_memory && kernel_library) {
+        vsapi->logMessage(mtDebug, "expr_cpp: kernels are loaded from "
+                                   "kernel_path, no JIT memory is used");
+    } else if (report_memory) {
+        // Planes can share a kernel
+        std::vector<const Kernel*> unique_kernels;
+        std::size_t code_size{0};
+        std::size_t mapped_size{0};
+        for (const auto& kernel: data->kernels) {
+            if (std::find(unique_kernels.cbegin(), unique_kernels.cend(),
+                          kernel.get()) == unique_kernels.cend()) {
+                unique_kernels.push_back(kernel.get());
+                code_size += kernel->code_size;
+                mapped_size += kernel->mapped_size;
             }
-            return process_source(*jit, src_builder, dump_info, i);
-        }()};
-        data->jit_funcs.push_back(jit_func);
-        data->dst_init.push_back({nullptr, i});
+        }
+        std::string message{"expr_cpp: kernels take "s
+                            + std::to_string(code_size) + " bytes in "s
+                            + std::to_string(mapped_size)
+                            + " bytes of JIT memory"s};
+        if (!data->kernels.empty()) {
+            message += ", JIT memory of all instances takes "s
+                       + std::to_string(get_compiler().memory_size())
+                       + " bytes"s;
+        }
+        vsapi->logMessage(mtDebug, message.c_str());
     }
 
-    data->jit = std::move(jit);
+    // Dimensions of inputs are checked against output above
+    plan.constant_dims = std::all_of(
+        data->srcs.cbegin(), data->srcs.cend(), [&](VSNodeRef* src) {
+            const VSVideoInfo* vi{vsapi->getVideoInfo(src)};
+            return vi->width != 0 && vi->height != 0;
+        });
+    if (plan.constant_dims) {
+        const VSVideoInfo& dst_info{data->dst_infos[0]};
+        for (gsl::index i{0}; i != plan.plane_count; ++i) {
+            plan.widths[i] =
+                dst_info.width >> (i == 0 ? 0 : dst_fmt->subSamplingW);
+            plan.heights[i] =
+                dst_info.height >> (i == 0 ? 0 : dst_fmt->subSamplingH);
+        }
+    }
 
     vsapi->createFilter(in, out, "expr_cpp", init, get_frame,
                         free, fmParallel, 0, data.release(), core);
@@ -504,10 +759,18 @@ VS_EXTERNAL_API(void) VapourSynthPluginInit(VSConfigPlugin config_func,
 {
     config_func("org.endill.expr", "expr", "C++-based Expr",
                 VAPOURSYNTH_API_VERSION, 1, plugin);
-    register_func("expr_cpp", "clips:clip[];code:data[];format:int:opt;"
-                              "source_path:data:opt;cxxflags:data[]:opt:empty;"
+    register_func("expr_cpp", "clips:clip[];code:data[]:opt;"
+                              "format:int[]:opt;outputs:int:opt;"
+                              "source_path:data:opt;kernel_path:data:opt;"
+                              "resample:data:opt;padded:int:opt;"
+                              "scan:data:opt;"
+                              "param_names:data[]:opt;"
+                              "param_values:float[]:opt;"
+                              "prop:data:opt;prop_values:int[]:opt;"
+                              "cxxflags:data[]:opt:empty;"
                               "dump_path:data:opt;dump_source:int:opt;"
-                              "dump_bitcode:int:opt;dump_binary:int:opt",
+                              "dump_bitcode:int:opt;dump_binary:int:opt;"
+                              "report_memory:int:opt;remarks:int:opt",
                   exprcpp::create, nullptr, plugin);
     return;
 }
\ No newline at end of file
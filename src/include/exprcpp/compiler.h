@@ -0,0 +1,77 @@
+#pragma once
+
+#include "exprcpp/dump_info.h"
+#include "exprcpp/jit_src_builder.h"
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32) && defined(EXPRCPP_JIT_BUILDING)
+#define EXPRCPP_JIT_API __declspec(dllexport)
+#elif defined(_WIN32)
+#define EXPRCPP_JIT_API __declspec(dllimport)
+#else
+#define EXPRCPP_JIT_API __attribute__((visibility("default")))
+#endif
+
+namespace exprcpp {
+
+inline const std::vector<const char*> default_cxxflags{"-O3", "-std=c++17",
+                                                       "-march=native"};
+
+// Added to cxxflags when user asks for vectorization remarks. Line tables
+// give remarks their source locations.
+inline const std::vector<const char*> remark_cxxflags{
+    "-Rpass=loop-vectorize", "-Rpass-missed=loop-vectorize",
+    "-Rpass-analysis=loop-vectorize", "-gline-tables-only", "-gcolumn-info"};
+
+// Optimization remark emitted while compiling a kernel
+struct Remark {
+    // Missed optimization. Analyses, which explain missed optimizations but
+    // are also emitted for vectorized loops, don't count.
+    bool missed;
+    std::string text;
+};
+
+// Entry function, which code stays valid as long as the kernel is alive
+class Kernel {
+public:
+    Jit_src_builder::entry_func_ptr func{nullptr};
+    // Bytes of code and data sections, zero if unknown
+    std::size_t code_size{0};
+    // Bytes of pages mapped for them, zero if not JIT-compiled
+    std::size_t mapped_size{0};
+    std::vector<Remark> remarks;
+
+    virtual ~Kernel() = default;
+};
+
+// Clang and LLVM live behind this interface in a separate library, so that
+// they are loaded only when something has to be compiled.
+class Compiler {
+public:
+    virtual ~Compiler() = default;
+
+    // Kernels are shared between planes and filter instances which sources
+    // and compiler flags are identical.
+    virtual std::shared_ptr<const Kernel> compile(
+        Jit_src_builder& src_builder, const Dump_info& dump_info,
+        const std::vector<const char*>& cxxflags) = 0;
+
+    // Writes kernels for every plane into relocatable object file or shared
+    // library, depending on output file extension. Such library can be loaded
+    // via kernel_path argument.
+    virtual void compile_to_file(
+        std::vector<Jit_src_builder>& src_builders, const Dump_info& dump_info,
+        const std::vector<const char*>& cxxflags,
+        const std::filesystem::path& output_path) = 0;
+
+    // Bytes currently mapped for code and data of all JIT-compiled kernels
+    virtual std::size_t memory_size() const = 0;
+};
+} // namespace exprcpp
+
+extern "C" EXPRCPP_JIT_API exprcpp::Compiler* exprcpp_get_compiler();
\ No newline at end of file
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vapoursynth/VapourSynth.h>
+
+#include <bitset>
+#include <filesystem>
+#include <string>
+
+namespace exprcpp {
+
+class Dump_info {
+public:
+    std::filesystem::path dump_path;
+
+    Dump_info() : dump_path{std::filesystem::current_path()} {}
+
+    Dump_info(const VSAPI& vsapi, const VSMap& vsmap)
+    {
+        using namespace std::literals;
+
+        int err{0};
+        auto get_bool_value{[&](const std::string& name, bool fallback) {
+            if (bool value{static_cast<bool>(
+                    vsapi.propGetInt(&vsmap, name.c_str(), 0, &err))}; !err) {
+                return value;
+            }
+            return fallback;
+        }};
+
+        dump_source( get_bool_value("dump_source"s,  false));
+        dump_bitcode(get_bool_value("dump_bitcode"s, false));
+        dump_binary( get_bool_value("dump_binary"s,  false));
+
+        this->dump_path = [&]() -> std::filesystem::path {
+            const char* path_c{vsapi.propGetData(&vsmap, "dump_path", 0, &err)};
+            if (err) {
+                auto path{std::filesystem::current_path()};
+                if (flags_.any()) {
+                    vsapi.logMessage(
+                        mtWarning, ("expr_cpp: using CWD for dumping: "s
+                                    + path.string()).c_str());
+                }
+                return path;
+            }
+            return {path_c};
+        }();
+
+    }
+
+    bool any() const          { return flags_.any(); }
+    bool dump_source() const  { return flags_[0]; }
+    bool dump_bitcode() const { return flags_[1]; }
+    bool dump_binary() const  { return flags_[2]; }
+
+    void dump_source(bool value)  { flags_[0] = value; }
+    void dump_bitcode(bool value) { flags_[1] = value; }
+    void dump_binary(bool value)  { flags_[2] = value; }
+
+private:
+    std::bitset<3> flags_;
+};
+} // namespace exprcpp
\ No newline at end of file
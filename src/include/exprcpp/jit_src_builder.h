@@ -2,10 +2,13 @@
 
 #include <vapoursynth/VapourSynth.h>
 
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
-#include <functional>
+#include <optional>
 #include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace exprcpp {
@@ -16,24 +19,87 @@ class Jit_src_builder {
 
     std::string create_includes();
     std::string create_loop_func();
+    std::string create_params_struct() const;
     std::string create_entry_func();
 
+    // Throws if name is not an identifier or is a keyword, what describes
+    // the name
+    static void check_name(const std::string& name, const std::string& what);
+
 public:
     static constexpr auto entry_func_ns{"exprcpp"};
     static constexpr auto entry_func_name{"run"};
-    using entry_func_ptr = void (*)(long, void**);
-    using entry_func_type =
-        std::function<std::remove_pointer_t<entry_func_ptr>>;
+    static constexpr auto params_struct_ns{"expr"};
+    static constexpr auto params_struct_name{"Params"};
+    // Output plane width and height, byte strides and data pointers of output
+    // and input planes, values of user parameters, value of frame property
+    using entry_func_ptr = void (*)(long, long, const long*, void**,
+                                    const double*, std::int64_t);
+    // Has to be bumped whenever entry function signature changes
+    static constexpr int abi_version{2};
+    // Symbols of kernel libraries compiled ahead of time
+    static constexpr auto kernel_symbol_prefix{"exprcpp_kernel_"};
+    static constexpr auto signature_symbol{"exprcpp_signature"};
+
+    // How planes with subsampling different from the output one are read
+    enum class Resample { nearest, average };
+    // Direction state of scan kernels is carried in
+    enum class Scan { none, right, left, down, up };
 
     static constexpr auto builtin_includes{"#include <cstdint>\n\n"};
 
+    // Alignment of frame data and strides VapourSynth guarantees
+    static constexpr long row_alignment{32};
+
     std::string user_func_name;
     const VSFormat* dst_fmt;
+    // Outputs besides the first one. They share dimensions and subsampling
+    // with it, and user function returns a tuple with a value for each.
+    std::vector<const VSFormat*> extra_dst_fmts;
     const std::vector<const VSFormat*>& src_fmts;
+    // Log2 of how many times every single-plane input is smaller than output
+    // luma plane, e.g. 1, 1 for chroma of YUV420 clip. Empty means that all of
+    // them have the size of luma plane.
+    std::vector<std::pair<int, int>> single_plane_subs;
+    int plane{0};
+    Resample resample{Resample::nearest};
+    // Passed to user function as the last argument, if not empty
+    std::vector<std::string> param_names;
+    // Process rows up to row alignment, writing into stride padding. Has no
+    // effect if any input is resampled.
+    bool padded{false};
+    // User function of scan kernels takes state by reference as the first
+    // argument. Padding is not processed.
+    Scan scan{Scan::none};
+    // Frame property exposed to user function as a member of parameters
+    // struct. Kernel is specialized for prop_value if it's present.
+    std::string prop_name;
+    std::optional<std::int64_t> prop_value;
 
     Jit_src_builder(const std::vector<const VSFormat*>& src_fmts);
 
-    const std::string& user_code();
+    // Entry of single_plane_subs, zeros if it's empty
+    std::pair<int, int> single_plane_sub(std::ptrdiff_t src) const;
+    // Log2 of the ratio between input and output plane dimensions
+    int src_shift_w(std::ptrdiff_t src) const;
+    int src_shift_h(std::ptrdiff_t src) const;
+
+    // Everything besides user code that compiled kernels depend on
+    std::string signature() const;
+
+    // Throws on unknown direction
+    static Scan parse_scan(const std::string& direction);
+
+    // User-supplied names become C++ identifiers in generated code. Throws if
+    // param_names or prop_name can't be used there, or if prop_values are
+    // given without prop_name or repeat.
+    void check_user_names(const std::vector<std::int64_t>& prop_values) const;
+
+    // Name of the kernel in a library compiled ahead of time
+    static std::string kernel_symbol(
+        int plane, std::optional<std::int64_t> prop_value);
+
+    std::string user_code() const;
     void user_code(const std::string& user_code);
     void user_code(const std::filesystem::path& path);
 
@@ -0,0 +1,27 @@
+#pragma once
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#include <llvm/Support/Error.h>
+#pragma clang diagnostic pop
+
+#include <stdexcept>
+#include <string>
+
+namespace exprcpp {
+
+template<typename T>
+T check_result(llvm::Expected<T>&& result, const std::string& message)
+{
+    if (!result) { throw std::runtime_error{message}; }
+    return std::move(*result);
+}
+
+template<typename T>
+T& check_result(llvm::Expected<T&>&& result, const std::string& message)
+{
+    if (!result) { throw std::runtime_error{message}; }
+    return *result;
+}
+
+} // namespace exprcpp
\ No newline at end of file
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <filesystem>
+
+namespace exprcpp {
+
+class Shared_library {
+    void* handle_;
+
+public:
+    explicit Shared_library(const std::filesystem::path& path);
+    ~Shared_library();
+
+    Shared_library(const Shared_library&) = delete;
+    Shared_library& operator=(const Shared_library&) = delete;
+
+    // Returns nullptr if there is no such symbol
+    void* symbol(const char* name) const;
+
+    // Directory of the binary this function is linked into
+    static std::filesystem::path current_module_dir();
+};
+} // namespace exprcpp
\ No newline at end of file
@@ -4,9 +4,13 @@
 
 #include <gsl/gsl>
 
+#include <algorithm>
+#include <cctype>
 #include <fstream>
 #include <iterator>
 #include <numeric>
+#include <stdexcept>
+#include <tuple>
 
 using namespace std::literals;
 
@@ -23,52 +27,334 @@ std::string Jit_src_builder::create_includes()
 
 std::string Jit_src_builder::create_loop_func()
 {
-    Expects(!this->user_func_name.empty());
-
     includes_.emplace("algorithm"s);
+    includes_.emplace("cstdint"s);
     includes_.emplace("limits"s);
+    includes_.emplace("new"s);
+    includes_.emplace("tuple"s);
     includes_.emplace("type_traits"s);
     includes_.emplace("utility"s);
-    static const auto user_func_placeholder{"USER_FUNC_NAME"s};
-    std::string loop_func{
-R"EOS(
+    return R"EOS(
 
 namespace exprcpp {
-template<typename Dst_ptr, typename... Src_ptrs,
-         typename Dst_t = std::remove_pointer_t<Dst_ptr>>
-void run_loop(long pixel_count, std::pair<Dst_t, Dst_t> value_range,
-              Dst_ptr dst, Src_ptrs... srcs)
+template<typename T>
+struct Plane {
+    T* data;
+    long stride;
+
+    T* row(long y) const { return data + y * stride; }
+};
+
+// Reads plane which subsampling differs from the output one. Positive shifts
+// mean that source is larger than output (downsampling), negative ones mean
+// that it's smaller (upsampling). Averaging takes 2 taps along every
+// resampled dimension.
+template<typename T, int Shift_w, int Shift_h, bool Average>
+struct Resampled_plane {
+    using Value_t = std::remove_const_t<T>;
+    using Acc_t = std::conditional_t<std::is_floating_point_v<Value_t>,
+                                     Value_t, std::int64_t>;
+
+    struct Row {
+        T* row0;
+        T* row1;
+        long last_x;
+
+        static long first_tap(long i, int shift)
+        {
+            if (shift > 0) {
+                return (i << shift) + (Average ? (1L << shift) / 2 - 1 : 0);
+            }
+            return i >> -shift;
+        }
+
+        static long second_tap(long i, int shift, long last)
+        {
+            if (shift > 0) { return first_tap(i, shift) + 1; }
+            if (shift < 0) {
+                return std::min((i + (1L << -shift) - 1) >> -shift, last);
+            }
+            return i;
+        }
+
+        Value_t operator[](long x) const
+        {
+            const long x0{first_tap(x, Shift_w)};
+            if constexpr (!Average) {
+                return row0[x0];
+            } else {
+                const long x1{second_tap(x, Shift_w, last_x)};
+                const Acc_t sum{Acc_t{row0[x0]} + Acc_t{row0[x1]}
+                                + Acc_t{row1[x0]} + Acc_t{row1[x1]}};
+                if constexpr (std::is_floating_point_v<Value_t>) {
+                    return sum * Value_t{0.25};
+                } else {
+                    return static_cast<Value_t>((sum + 2) / 4);
+                }
+            }
+        }
+    };
+
+    T* data;
+    long stride;
+    long width;
+    long height;
+
+    Row row(long y) const
+    {
+        const long y0{Row::first_tap(y, Shift_h)};
+        const long y1{Average ? Row::second_tap(y, Shift_h, height - 1) : y0};
+        return {data + y0 * stride, data + y1 * stride, width - 1};
+    }
+};
+
+template<typename T>
+constexpr bool is_plain_plane_v{false};
+
+template<typename T>
+constexpr bool is_plain_plane_v<Plane<T>>{true};
+
+// Clamps values of wider integer types to output range
+template<typename Dst_t, typename User_t>
+void store(Dst_t& dst, User_t value, std::pair<Dst_t, Dst_t> value_range)
+{
+    if constexpr (!std::is_same_v<Dst_t, User_t>
+                  && std::is_integral_v<Dst_t>
+                  && std::is_integral_v<User_t>
+                  && std::numeric_limits<Dst_t>::max()
+                     < std::numeric_limits<User_t>::max()) {
+        dst = std::clamp<User_t>(value, value_range.first, value_range.second);
+    } else {
+        dst = value;
+    }
+}
+
+template<typename Func, typename Dst_t, typename... Src_rows>
+void run_row(const Func& func, long pixel_count,
+             std::pair<Dst_t, Dst_t> value_range, Dst_t* __restrict dst,
+             Src_rows... srcs)
+{
+    for (long i{0}; i < pixel_count; ++i) {
+        store(dst[i], func(srcs[i]...), value_range);
+    }
+}
+
+template<typename Func, typename Dst_t, typename... Srcs>
+void run_loop(const Func& func, long width, long height,
+              std::pair<Dst_t, Dst_t> value_range, Plane<Dst_t> dst,
+              Srcs... srcs)
+{
+    if constexpr ((is_plain_plane_v<Srcs> && ...)) {
+        if (dst.stride == width && ((srcs.stride == width) && ...)) {
+            run_row(func, width * height, value_range, dst.data,
+                    srcs.data...);
+            return;
+        }
+    }
+    for (long y{0}; y < height; ++y) {
+        run_row(func, width, value_range, dst.row(y), srcs.row(y)...);
+    }
+}
+
+template<typename Dst_rows, typename Values, typename Ranges,
+         std::size_t... Indices>
+void store_all(const Dst_rows& dsts, long i, const Values& values,
+               const Ranges& value_ranges, std::index_sequence<Indices...>)
+{
+    (store(std::get<Indices>(dsts)[i], std::get<Indices>(values),
+           std::get<Indices>(value_ranges)), ...);
+}
+
+// User function of multi-output kernels returns a tuple-like value with an
+// element for every output
+template<typename Func, typename Dst_rows, typename Ranges,
+         typename... Src_rows>
+void run_multi_row(const Func& func, long pixel_count,
+                   const Ranges& value_ranges, const Dst_rows& dsts,
+                   Src_rows... srcs)
 {
-    using User_t = decltype(USER_FUNC_NAME(srcs[0]...));
+    constexpr std::size_t dst_count{std::tuple_size_v<Dst_rows>};
+    using User_t = decltype(func(srcs[0]...));
+    static_assert(std::tuple_size_v<User_t> == dst_count,
+                  "User function has to return a value for every output");
 
     for (long i{0}; i < pixel_count; ++i) {
-        if constexpr (!std::is_same_v<Dst_t, User_t>
-                      && std::is_integral_v<Dst_t>
-                      && std::is_integral_v<User_t>
-                      && std::numeric_limits<Dst_t>::max()
-                         < std::numeric_limits<User_t>::max()) {
-            dst[i] = std::clamp<User_t>(USER_FUNC_NAME(srcs[i]...),
-                                        value_range.first, value_range.second);
-        } else {
-            dst[i] = USER_FUNC_NAME(srcs[i]...);
+        store_all(dsts, i, func(srcs[i]...), value_ranges,
+                  std::make_index_sequence<dst_count>{});
+    }
+}
+
+template<typename Func, typename... Dst_ts, typename... Srcs>
+void run_multi_loop(const Func& func, long width, long height,
+                    std::tuple<std::pair<Dst_ts, Dst_ts>...> value_ranges,
+                    std::tuple<Plane<Dst_ts>...> dsts, Srcs... srcs)
+{
+    auto dst_rows{[&](long y) {
+        return std::apply([y](const auto&... dst) {
+            return std::tuple{dst.row(y)...};
+        }, dsts);
+    }};
+    if constexpr ((is_plain_plane_v<Srcs> && ...)) {
+        const bool flat{std::apply([width](const auto&... dst) {
+            return ((dst.stride == width) && ...);
+        }, dsts)};
+        if (flat && ((srcs.stride == width) && ...)) {
+            run_multi_row(func, width * height, value_ranges, dst_rows(0),
+                          srcs.data...);
+            return;
+        }
+    }
+    for (long y{0}; y < height; ++y) {
+        run_multi_row(func, width, value_ranges, dst_rows(y),
+                      srcs.row(y)...);
+    }
+}
+
+// State of scan kernels is the type user function takes by reference as its
+// first parameter
+template<typename Func>
+struct Scan_state;
+
+template<typename Ret, typename State, typename... Args>
+struct Scan_state<Ret (*)(State&, Args...)> {
+    using type = State;
+};
+
+template<typename Ret, typename State, typename... Args>
+struct Scan_state<Ret (*)(State&, Args...) noexcept> {
+    using type = State;
+};
+
+template<typename Func>
+using scan_state_t = typename Scan_state<Func>::type;
+
+// Carries state along Rows rows starting at y0 at once. Rows are
+// independent, so their dependency chains overlap instead of each pixel
+// waiting for the previous one.
+template<long Rows, bool Forward, typename State, typename Func,
+         typename Dst_t, typename... Srcs>
+void scan_rows(const Func& func, long width, long y0,
+               std::pair<Dst_t, Dst_t> value_range, Plane<Dst_t> dst,
+               Srcs... srcs)
+{
+    State states[Rows]{};
+    for (long i{0}; i < width; ++i) {
+        const long x{Forward ? i : width - 1 - i};
+        for (long r{0}; r < Rows; ++r) {
+            store(dst.row(y0 + r)[x], func(states[r], srcs.row(y0 + r)[x]...),
+                  value_range);
+        }
+    }
+}
+
+// Carries state along every row, left to right if Forward
+template<bool Forward, typename State, typename Func, typename Dst_t,
+         typename... Srcs>
+void run_row_scan(const Func& func, long width, long height,
+                  std::pair<Dst_t, Dst_t> value_range, Plane<Dst_t> dst,
+                  Srcs... srcs)
+{
+    constexpr long block_rows{8};
+    long y{0};
+    for (; y + block_rows <= height; y += block_rows) {
+        scan_rows<block_rows, Forward, State>(func, width, y, value_range,
+                                              dst, srcs...);
+    }
+    for (; y < height; ++y) {
+        scan_rows<1, Forward, State>(func, width, y, value_range, dst,
+                                     srcs...);
+    }
+}
+
+// Carries state along every column, top to bottom if Forward. Columns are
+// independent, so rows are processed as a whole, which vectorizes across
+// columns.
+template<bool Forward, typename State, typename Func, typename Dst_t,
+         typename... Srcs>
+void run_column_scan(const Func& func, long width, long height,
+                     std::pair<Dst_t, Dst_t> value_range, Plane<Dst_t> dst,
+                     Srcs... srcs)
+{
+    // Operator new is not available
+    State* __restrict states{static_cast<State*>(
+        __builtin_alloca(width * static_cast<long>(sizeof(State))))};
+    for (long x{0}; x < width; ++x) {
+        new (states + x) State{};
+    }
+    auto scan_row{[&](Dst_t* __restrict dst_row, auto... src_rows) {
+        for (long x{0}; x < width; ++x) {
+            store(dst_row[x], func(states[x], src_rows[x]...), value_range);
         }
+    }};
+    for (long i{0}; i < height; ++i) {
+        const long y{Forward ? i : height - 1 - i};
+        scan_row(dst.row(y), srcs.row(y)...);
+    }
+}
+
+template<long Align, typename T>
+T* assume_aligned(T* ptr)
+{
+    return static_cast<T*>(__builtin_assume_aligned(ptr, Align));
+}
+
+// Processes rows up to the next multiple of Align bytes of the widest type,
+// which stays within stride padding of every plane. Expressing pixel count
+// in whole blocks lets vectorizer skip remainder iterations.
+template<long Align, typename Func, typename Dst_t, typename... Src_ts>
+void run_padded_loop(const Func& func, long width, long height,
+                     std::pair<Dst_t, Dst_t> value_range, Plane<Dst_t> dst,
+                     Plane<Src_ts>... srcs)
+{
+    constexpr long block{Align / static_cast<long>(
+        std::max({sizeof(Dst_t), sizeof(Src_ts)...}))};
+    const long block_count{(width + block - 1) / block};
+    if (((dst.stride == srcs.stride) && ...)
+        && dst.stride == block_count * block) {
+        run_row(func, block_count * height * block, value_range,
+                assume_aligned<Align>(dst.data),
+                assume_aligned<Align>(srcs.data)...);
+        return;
+    }
+    for (long y{0}; y < height; ++y) {
+        run_row(func, block_count * block, value_range,
+                assume_aligned<Align>(dst.row(y)),
+                assume_aligned<Align>(srcs.row(y))...);
     }
 }
 } // namespace exprcpp
 
-)EOS"s};
+)EOS"s;
+}
+
+std::string Jit_src_builder::create_params_struct() const
+{
+    if (this->param_names.empty() && this->prop_name.empty()) { return ""s; }
 
-    auto pos{loop_func.find(user_func_placeholder)};
-    while (pos != std::string::npos) {
-        loop_func.replace(pos, ssize(user_func_placeholder),
-                          this->user_func_name);
-        pos = loop_func.find(user_func_placeholder, pos + 1);
+    std::string params_struct{
+"namespace "s + params_struct_ns + " {\n"s
+"struct "s + params_struct_name + " {\n"s};
+    for (const auto& name: this->param_names) {
+        params_struct +=
+"    double "s + name + ";\n"s;
+    }
+    if (this->prop_value) {
+        params_struct +=
+"    static constexpr std::int64_t "s + this->prop_name + "{"s
+                       + std::to_string(*this->prop_value) + "};\n"s;
+    } else if (!this->prop_name.empty()) {
+        params_struct +=
+"    std::int64_t "s + this->prop_name + ";\n"s;
     }
-    return loop_func;
+    params_struct +=
+"};\n"s
+"} // namespace "s + params_struct_ns + "\n\n"s;
+    return params_struct;
 }
 
 std::string Jit_src_builder::create_entry_func()
 {
+    Expects(!this->user_func_name.empty());
     Expects(this->dst_fmt);
 
     includes_.emplace("cstdint"s);
@@ -92,40 +378,163 @@ std::string Jit_src_builder::create_entry_func()
         throw std::runtime_error{"Unsupported sample type"s};
     }};
 
-    static auto to_ptr_string{[&](const VSFormat& fmt,
-                                  bool immutable = true) {
-        if (!immutable) {
-            return to_string(fmt) + "* const"s;
+    static auto to_plane_string{[&](const VSFormat& fmt, bool immutable) {
+        return "exprcpp::Plane<"s + (immutable ? "const "s : ""s)
+               + to_string(fmt) + ">"s;
+    }};
+
+    static auto to_size_string{[&](const std::string& size, int shift) {
+        if (shift > 0) { return size + " << "s + std::to_string(shift); }
+        return "("s + size + " + "s + std::to_string((1 << -shift) - 1)
+               + ") >> "s + std::to_string(-shift);
+    }};
+
+    // Name, type and initializer
+    std::vector<std::tuple<std::string, std::string, std::string>> planes;
+    bool resampled{false};
+    const gsl::index dst_count{1 + ssize(this->extra_dst_fmts)};
+    auto add_plane{[&](const std::string& name, const VSFormat& fmt,
+                       gsl::index index, bool immutable) {
+        const std::string index_str{std::to_string(index)};
+        const std::string ptr_type{(immutable ? "const "s : ""s)
+                                   + to_string(fmt) + "*"s};
+        const std::string ptr{"static_cast<"s + ptr_type + ">(data_ptrs["s
+                              + index_str + "])"s};
+        const std::string stride{"strides["s + index_str + "] / "s
+                                 "static_cast<long>(sizeof("s
+                                 + to_string(fmt) + "))"s};
+
+        const int shift_w{immutable ? src_shift_w(index - dst_count) : 0};
+        const int shift_h{immutable ? src_shift_h(index - dst_count) : 0};
+        if (shift_w == 0 && shift_h == 0) {
+            planes.emplace_back(name, to_plane_string(fmt, immutable),
+                                ptr + ", "s + stride);
+            return;
         }
-        return "const "s + to_string(fmt) + "* const"s;
+        resampled = true;
+        const std::string type{
+            "exprcpp::Resampled_plane<"s + (immutable ? "const "s : ""s)
+            + to_string(fmt) + ", "s + std::to_string(shift_w) + ", "s
+            + std::to_string(shift_h) + ", "s
+            + (this->resample == Resample::average ? "true"s : "false"s)
+            + ">"s};
+        planes.emplace_back(name, type,
+                            ptr + ", "s + stride + ", "s
+                            + to_size_string("width"s, shift_w) + ", "s
+                            + to_size_string("height"s, shift_h));
     }};
 
-    std::vector<std::pair<std::string, std::string>> ptrs{
-        {"dst"s, to_ptr_string(*this->dst_fmt, /* immutable */ false)}};
+    add_plane("dst"s, *this->dst_fmt, 0, /* immutable */ false);
+    for (gsl::index i{1}; i != dst_count; ++i) {
+        add_plane("dst"s + std::to_string(i), *this->extra_dst_fmts[i - 1], i,
+                  /* immutable */ false);
+    }
     for (gsl::index i{0}; i != ssize(this->src_fmts); ++i) {
-        ptrs.emplace_back("src"s + std::to_string(i),
-                          to_ptr_string(*this->src_fmts[i]));
+        add_plane("src"s + std::to_string(i), *this->src_fmts[i],
+                  dst_count + i, /* immutable */ true);
+    }
+    if (dst_count > 1 && this->scan != Scan::none) {
+        throw std::runtime_error{
+            "Scan kernels can't have multiple outputs"s};
     }
 
     std::string entry_func;
     entry_func +=
 "\nnamespace "s + entry_func_ns + " {\n"s;
     entry_func +=
-"void "s + entry_func_name + "(long pixel_count, void** data_ptrs)\n"s
+"void "s + entry_func_name + "(long width, long height, const long* strides,\n"s
+"         void** data_ptrs, const double* param_values,\n"s
+"         std::int64_t prop_value)\n"s
 "{\n"s;
-    for (gsl::index i{0}; i != ssize(ptrs); ++i) {
-        const std::string name{ptrs[i].first};
-        const std::string type{ptrs[i].second};
-        const std::string index{std::to_string(i)};
+    for (const auto& [name, type, init]: planes) {
         entry_func +=
-"    auto* const __restrict "s + name + "{static_cast<"s + type + ">("s
-                                              "data_ptrs["s + index + "])};\n"s;
+"    const "s + type + " "s + name + "{"s + init + "};\n"s;
     }
-    entry_func +=
-"    exprcpp::run_loop(pixel_count, {0, "s
-               + std::to_string((1 << this->dst_fmt->bitsPerSample) - 1) + "}"s;
-    for (const auto& [name, _]: ptrs) {
-        entry_func += ", "s + name;
+    if (this->param_names.empty()) {
+        entry_func +=
+"    static_cast<void>(param_values);\n"s;
+    }
+    if (this->prop_name.empty() || this->prop_value) {
+        entry_func +=
+"    static_cast<void>(prop_value);\n"s;
+    }
+    const bool is_scan{this->scan != Scan::none};
+    const std::string state_param{is_scan ? "State& state, "s : ""s};
+    const std::string state_arg{is_scan ? "state, "s : ""s};
+    if (is_scan) {
+        entry_func +=
+"    using State = exprcpp::scan_state_t<decltype(&::"s
+                      + this->user_func_name + ")>;\n"s;
+    }
+    if (this->param_names.empty() && this->prop_name.empty()) {
+        entry_func +=
+"    const auto user_func{[]("s + state_param + "auto... values) {\n"s
+"        return ::"s + this->user_func_name + "("s + state_arg
+                      + "values...);\n"s
+"    }};\n"s;
+    } else {
+        entry_func +=
+"    const "s + params_struct_ns + "::"s + params_struct_name + " params{"s;
+        for (gsl::index i{0}; i != ssize(this->param_names); ++i) {
+            entry_func += (i == 0 ? ""s : ", "s)
+                          + "param_values["s + std::to_string(i) + "]"s;
+        }
+        if (!this->prop_name.empty() && !this->prop_value) {
+            entry_func += this->param_names.empty() ? "prop_value"s
+                                                    : ", prop_value"s;
+        }
+        entry_func += "};\n"s
+"    const auto user_func{[&params]("s + state_param
+                      + "auto... values) {\n"s
+"        return ::"s + this->user_func_name + "("s + state_arg
+                      + "values..., params);\n"s
+"    }};\n"s;
+    }
+    if (this->scan == Scan::right || this->scan == Scan::left) {
+        entry_func +=
+"    exprcpp::run_row_scan<"s
+                      + (this->scan == Scan::right ? "true"s : "false"s)
+                      + ", State>("s;
+    } else if (this->scan == Scan::down || this->scan == Scan::up) {
+        entry_func +=
+"    exprcpp::run_column_scan<"s
+                      + (this->scan == Scan::down ? "true"s : "false"s)
+                      + ", State>("s;
+    } else if (dst_count > 1) {
+        entry_func +=
+"    exprcpp::run_multi_loop("s;
+    // Resampled planes read outside of row padding
+    } else if (this->padded && !resampled) {
+        entry_func +=
+"    exprcpp::run_padded_loop<"s + std::to_string(row_alignment) + ">("s;
+    } else {
+        entry_func +=
+"    exprcpp::run_loop("s;
+    }
+    entry_func += "user_func, width, height, "s;
+    auto value_range{[](const VSFormat& fmt) {
+        return "{0, "s + std::to_string((1 << fmt.bitsPerSample) - 1) + "}"s;
+    }};
+    if (dst_count == 1) {
+        entry_func += value_range(*this->dst_fmt);
+        for (const auto& plane_info: planes) {
+            entry_func += ", "s + std::get<0>(plane_info);
+        }
+    } else {
+        // Destinations and their value ranges are grouped into tuples
+        entry_func += "std::tuple{"s;
+        for (gsl::index i{0}; i != dst_count; ++i) {
+            const VSFormat& fmt{i == 0 ? *this->dst_fmt
+                                       : *this->extra_dst_fmts[i - 1]};
+            entry_func += (i == 0 ? ""s : ", "s) + "std::pair<"s
+                          + to_string(fmt) + ", "s + to_string(fmt) + ">"s
+                          + value_range(fmt);
+        }
+        entry_func += "}, std::tuple{"s;
+        for (gsl::index i{0}; i != ssize(planes); ++i) {
+            entry_func += (i == 0 ? ""s : i == dst_count ? "}, "s : ", "s)
+                          + std::get<0>(planes[i]);
+        }
     }
     entry_func += ");\n"s
 "}\n"s;
@@ -134,21 +543,179 @@ std::string Jit_src_builder::create_entry_func()
     return entry_func;
 }
 
+std::pair<int, int> Jit_src_builder::single_plane_sub(gsl::index src) const
+{
+    return this->single_plane_subs.empty() ? std::pair{0, 0}
+                                           : this->single_plane_subs[src];
+}
+
+int Jit_src_builder::src_shift_w(gsl::index src) const
+{
+    const VSFormat& src_fmt{*this->src_fmts[src]};
+    const int dst_sub{this->plane == 0 ? 0 : this->dst_fmt->subSamplingW};
+    const int src_sub{src_fmt.numPlanes == 1 ? single_plane_sub(src).first
+                      : this->plane == 0 ? 0 : src_fmt.subSamplingW};
+    return dst_sub - src_sub;
+}
+
+int Jit_src_builder::src_shift_h(gsl::index src) const
+{
+    const VSFormat& src_fmt{*this->src_fmts[src]};
+    const int dst_sub{this->plane == 0 ? 0 : this->dst_fmt->subSamplingH};
+    const int src_sub{src_fmt.numPlanes == 1 ? single_plane_sub(src).second
+                      : this->plane == 0 ? 0 : src_fmt.subSamplingH};
+    return dst_sub - src_sub;
+}
+
 Jit_src_builder::Jit_src_builder(const std::vector<const VSFormat*>& src_fmts)
     : src_fmts{src_fmts} {}
 
-const std::string& Jit_src_builder::user_code() { return user_code_; }
+std::string Jit_src_builder::signature() const
+{
+    static auto to_string{[](const VSFormat& fmt) {
+        return std::to_string(fmt.sampleType) + ":"s
+               + std::to_string(fmt.bitsPerSample) + ":"s
+               + std::to_string(fmt.subSamplingW) + ":"s
+               + std::to_string(fmt.subSamplingH) + ":"s
+               + std::to_string(fmt.numPlanes);
+    }};
+
+    std::string signature{"abi="s + std::to_string(abi_version)};
+    signature += ";dst="s + to_string(*this->dst_fmt);
+    for (const auto* fmt: this->extra_dst_fmts) {
+        signature += ","s + to_string(*fmt);
+    }
+    signature += ";srcs="s;
+    for (gsl::index i{0}; i != ssize(this->src_fmts); ++i) {
+        signature += (i == 0 ? ""s : ","s) + to_string(*this->src_fmts[i]);
+        if (const auto [sub_w, sub_h]{single_plane_sub(i)};
+            sub_w != 0 || sub_h != 0) {
+            signature += "/"s + std::to_string(sub_w) + ":"s
+                         + std::to_string(sub_h);
+        }
+    }
+    signature += ";resample="s + (this->resample == Resample::average
+                                  ? "average"s : "nearest"s);
+    signature += ";padded="s + (this->padded ? "1"s : "0"s);
+    static const std::string scan_names[]{
+        "none"s, "right"s, "left"s, "down"s, "up"s};
+    signature += ";scan="s + scan_names[static_cast<int>(this->scan)];
+    signature += ";params="s;
+    for (gsl::index i{0}; i != ssize(this->param_names); ++i) {
+        signature += (i == 0 ? ""s : ","s) + this->param_names[i];
+    }
+    signature += ";prop="s + this->prop_name;
+    return signature;
+}
+
+Jit_src_builder::Scan Jit_src_builder::parse_scan(const std::string& direction)
+{
+    if (direction == "right"s) { return Scan::right; }
+    if (direction == "left"s)  { return Scan::left; }
+    if (direction == "down"s)  { return Scan::down; }
+    if (direction == "up"s)    { return Scan::up; }
+    throw std::runtime_error{"Unknown scan direction: "s + direction};
+}
+
+void Jit_src_builder::check_name(const std::string& name,
+                                 const std::string& what)
+{
+    static const std::set<std::string> keywords{
+        "alignas"s, "alignof"s, "and"s, "and_eq"s, "asm"s, "auto"s,
+        "bitand"s, "bitor"s, "bool"s, "break"s, "case"s, "catch"s, "char"s,
+        "char8_t"s, "char16_t"s, "char32_t"s, "class"s, "compl"s, "concept"s,
+        "const"s, "consteval"s, "constexpr"s, "constinit"s, "const_cast"s,
+        "continue"s, "co_await"s, "co_return"s, "co_yield"s, "decltype"s,
+        "default"s, "delete"s, "do"s, "double"s, "dynamic_cast"s, "else"s,
+        "enum"s, "explicit"s, "export"s, "extern"s, "false"s, "float"s,
+        "for"s, "friend"s, "goto"s, "if"s, "inline"s, "int"s, "long"s,
+        "mutable"s, "namespace"s, "new"s, "noexcept"s, "not"s, "not_eq"s,
+        "nullptr"s, "operator"s, "or"s, "or_eq"s, "private"s, "protected"s,
+        "public"s, "register"s, "reinterpret_cast"s, "requires"s, "return"s,
+        "short"s, "signed"s, "sizeof"s, "static"s, "static_assert"s,
+        "static_cast"s, "struct"s, "switch"s, "template"s, "this"s,
+        "thread_local"s, "throw"s, "true"s, "try"s, "typedef"s, "typeid"s,
+        "typename"s, "union"s, "unsigned"s, "using"s, "virtual"s, "void"s,
+        "volatile"s, "wchar_t"s, "while"s, "xor"s, "xor_eq"s
+    };
+
+    const bool is_identifier{
+        !name.empty()
+        && !std::isdigit(static_cast<unsigned char>(name[0]))
+        && std::all_of(name.cbegin(), name.cend(), [](char c) {
+            return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+        })};
+    if (!is_identifier) {
+        throw std::runtime_error{what + " is not a valid identifier: "s + name};
+    }
+    if (keywords.count(name) != 0) {
+        throw std::runtime_error{what + " is a C++ keyword: "s + name};
+    }
+}
+
+void Jit_src_builder::check_user_names(
+    const std::vector<std::int64_t>& prop_values) const
+{
+    const auto& names{this->param_names};
+    for (auto it{names.cbegin()}; it != names.cend(); ++it) {
+        check_name(*it, "Parameter name"s);
+        if (std::find(names.cbegin(), it, *it) != it) {
+            throw std::runtime_error{"Duplicate parameter name: "s + *it};
+        }
+    }
+    if (this->prop_name.empty()) {
+        if (!prop_values.empty()) {
+            throw std::runtime_error{
+                "Property values are given without name"s};
+        }
+        return;
+    }
+    check_name(this->prop_name, "Property name"s);
+    if (std::find(names.cbegin(), names.cend(), this->prop_name)
+        != names.cend()) {
+        throw std::runtime_error{
+            "Property name is the same as parameter name: "s
+            + this->prop_name};
+    }
+    for (auto it{prop_values.cbegin()}; it != prop_values.cend(); ++it) {
+        if (std::find(prop_values.cbegin(), it, *it) != it) {
+            throw std::runtime_error{
+                "Duplicate property value: "s + std::to_string(*it)};
+        }
+    }
+}
+
+std::string Jit_src_builder::kernel_symbol(
+    int plane, std::optional<std::int64_t> prop_value)
+{
+    std::string symbol{kernel_symbol_prefix + std::to_string(plane)};
+    if (prop_value) {
+        std::string value{std::to_string(*prop_value)};
+        // Minus sign is not welcome in symbol names
+        if (value.front() == '-') { value.front() = 'n'; }
+        symbol += "_"s + value;
+    }
+    return symbol;
+}
+
+std::string Jit_src_builder::user_code() const
+{
+    // Multi-output kernels return tuples
+    const std::string tuple_include{
+        this->extra_dst_fmts.empty() ? ""s : "#include <tuple>\n\n"s};
+    return builtin_includes + tuple_include + create_params_struct()
+           + user_code_;
+}
 
 void Jit_src_builder::user_code(const std::string& user_code)
 {
-    user_code_ = builtin_includes + user_code;
+    user_code_ = user_code;
 }
 
 void Jit_src_builder::user_code(const std::filesystem::path& path)
 {
     std::ifstream ifs{path};
-    user_code_ = builtin_includes
-                 + std::string{std::istreambuf_iterator<char>{ifs}, {}};
+    user_code_ = std::string{std::istreambuf_iterator<char>{ifs}, {}};
 }
 
 std::string Jit_src_builder::full_source()
@@ -156,6 +723,6 @@ std::string Jit_src_builder::full_source()
     const std::string loop_func{create_loop_func()};
     const std::string entry_func{create_entry_func()};
     // create_includes() needs to be invoked the last
-    return create_includes() + user_code_ + loop_func + entry_func;
+    return create_includes() + user_code() + loop_func + entry_func;
 }
 } // namespace exprcpp
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "exprcpp/shared_library.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#include <stdexcept>
+#include <string>
+
+using namespace std::literals;
+
+namespace exprcpp {
+
+#ifdef _WIN32
+
+Shared_library::Shared_library(const std::filesystem::path& path)
+    : handle_{LoadLibraryW(path.c_str())}
+{
+    if (!handle_) {
+        throw std::runtime_error{"Failed to load "s + path.string()};
+    }
+}
+
+Shared_library::~Shared_library()
+{
+    FreeLibrary(static_cast<HMODULE>(handle_));
+}
+
+void* Shared_library::symbol(const char* name) const
+{
+    return reinterpret_cast<void*>(
+        GetProcAddress(static_cast<HMODULE>(handle_), name));
+}
+
+std::filesystem::path Shared_library::current_module_dir()
+{
+    HMODULE module{nullptr};
+    if (!GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS
+                            | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                            reinterpret_cast<LPCWSTR>(&current_module_dir),
+                            &module)) {
+        throw std::runtime_error{"Failed to find current module"s};
+    }
+    wchar_t path[MAX_PATH];
+    if (!GetModuleFileNameW(module, path, MAX_PATH)) {
+        throw std::runtime_error{"Failed to get current module path"s};
+    }
+    return std::filesystem::path{path}.parent_path();
+}
+
+#else
+
+Shared_library::Shared_library(const std::filesystem::path& path)
+    : handle_{dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL)}
+{
+    if (!handle_) {
+        throw std::runtime_error{"Failed to load "s + path.string() + ": "s
+                                 + dlerror()};
+    }
+}
+
+Shared_library::~Shared_library()
+{
+    dlclose(handle_);
+}
+
+void* Shared_library::symbol(const char* name) const
+{
+    return dlsym(handle_, name);
+}
+
+std::filesystem::path Shared_library::current_module_dir()
+{
+    Dl_info info;
+    if (!dladdr(reinterpret_cast<void*>(&current_module_dir), &info)
+        || !info.dli_fname) {
+        throw std::runtime_error{"Failed to find current module"s};
+    }
+    return std::filesystem::path{info.dli_fname}.parent_path();
+}
+
+#endif
+} // namespace exprcpp
\ No newline at end of file